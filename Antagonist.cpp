@@ -0,0 +1,63 @@
+#include "Antagonist.h"
+#include "Core/Vector.h"
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+static std::atomic<bool> stop_flag(false);
+static Vector<std::thread*> threads;
+
+static void streaming_loop(int bytes)
+{
+    Vector<char> a(bytes), b(bytes);
+    memset(a.data(), 1, bytes);
+    memset(b.data(), 2, bytes);
+    while (!stop_flag.load(std::memory_order_relaxed)) {
+        memcpy(a.data(), b.data(), bytes);
+        memcpy(b.data(), a.data(), bytes);
+    }
+}
+
+static void chasing_loop(int bytes, unsigned seed)
+{
+    // A single random cycle through all the elements, so that the chase
+    // visits the whole array before repeating.
+    const int n = bytes / sizeof(int);
+    Vector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    std::shuffle(order.data(), order.data() + n, std::default_random_engine(seed));
+    Vector<int> next(n);
+    for (int i = 0; i < n; i++)
+        next[order[i]] = order[(i + 1) % n];
+
+    volatile int sink = 0;
+    int p = 0;
+    while (!stop_flag.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 4096; i++)
+            p = next[p];
+        sink = p;
+    }
+    (void)sink;
+}
+
+void start_antagonists(int streaming, int chasing, int buffer_bytes)
+{
+    stop_flag = false;
+    for (int i = 0; i < streaming; i++)
+        threads.append(new (OrDie) std::thread(streaming_loop, buffer_bytes));
+    for (int i = 0; i < chasing; i++)
+        threads.append(new (OrDie) std::thread(chasing_loop, buffer_bytes, (unsigned)i + 1));
+}
+
+void stop_antagonists()
+{
+    stop_flag = true;
+    for (std::thread *t : threads) {
+        t->join();
+        delete t;
+    }
+    threads.clear();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Background threads which compete with the benchmarks for memory bandwidth
+// and cache. Streaming threads copy between two large buffers, chasing
+// threads follow a random cycle through a large array, which keeps DRAM
+// latency-bound requests in flight. Each thread gets its own buffers of
+// buffer_bytes. They run until stop_antagonists().
+void start_antagonists(int streaming, int chasing, int buffer_bytes);
+void stop_antagonists();
@@ -1,43 +1,52 @@
 #include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
 #include "Core/Vector.h"
 #include "Math/Sphere.h"
 #include "Math/Frustum.h"
-#include <chrono>
 #include <random>
 #include <algorithm>
 
+namespace {
+
 struct Data {
-    Vector<Sphere> spheres = Vector<Sphere>(&sse_allocator);
-    Vector<uint32_t> results;
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
 
     // Maps 3d position (offset_3d(Vec3i(x, y, z), Vec3i(data_size)) to actual
     // sphere position.
-    Vector<int> mapping;
+    Vector<int> mapping = Vector<int>(&mapping_memory);
+
+    // Optional per-sphere layer masks, parallel to spheres, see run_layers().
+    Vector<uint32_t> layers = Vector<uint32_t>(&layer_memory);
 };
 
+}
+
 static Data generate_data(DataType data_type, const Config &config)
 {
     Data data;
     const int half_size = config.data_size/2;
+    Sphere *s = data.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
     for (int z = 0; z < config.data_size; z++) {
     for (int y = 0; y < config.data_size; y++) {
     for (int x = 0; x < config.data_size; x++) {
         const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
-        data.spheres.pappend(ToVec3f(p), 1.0f);
+        *s++ = Sphere(ToVec3f(p), 1.0f);
     }}}
 
+    int *mapping = data.mapping.append_uninitialized(data.spheres.length());
     for (int i = 0; i < data.spheres.length(); i++)
-        data.mapping.append(i);
+        mapping[i] = i;
 
     data.results.resize((data.spheres.length() + 31) / 32);
     fill<uint32_t>(data.results, 0);
 
     // If random data is requested, shuffle the mapping and move the spheres.
     if (data_type == Random) {
-        auto seed = std::chrono::system_clock::now().time_since_epoch().count();
         std::shuffle(data.mapping.data(), data.mapping.data() + data.mapping.length(),
-            std::default_random_engine(seed));
-        Vector<Sphere> spheres_tmp(&sse_allocator);
+            std::default_random_engine(config.seed));
+        Vector<Sphere> spheres_tmp(&sphere_memory);
         spheres_tmp.resize(data.spheres.length());
         for (int i = 0; i < data.spheres.length(); i++) {
             spheres_tmp[data.mapping[i]] = data.spheres[i];
@@ -63,24 +72,97 @@ static Vector<uint32_t> get_results(const Data &data)
     return out;
 }
 
-void do_arrays(const Config &config)
+typedef void (*CullFunc)(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frustum &f);
+static const CullFunc kernels[] = {naive_cull, sse_cull};
+
+// args: kernel index, data type
+static Stats run_array(const Benchmark &b, const Config &config)
 {
     const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
-    Data data;
-
-    data = generate_data(Structured, config);
-    measure([&]{ naive_cull(data.results, data.spheres, f); }, 50, 10, "Naive culling / structured data", config);
+    const CullFunc cull = kernels[b.args[0]];
+    Data data = generate_data((DataType)b.args[1], config);
+    const Stats stats = measure([&]{ cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
     print_results(get_results(data), config);
+    return stats;
+}
 
-    data = generate_data(Random, config);
-    measure([&]{ naive_cull(data.results, data.spheres, f); }, 50, 10, "Naive culling / random data", config);
-    print_results(get_results(data), config);
+// Every sphere is on one of 8 layers (bits 0-7), half of them are also shadow
+// casters (bit 31).
+static const uint32_t shadow_caster_layer = 1U << 31;
 
-    data = generate_data(Structured, config);
-    measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, "SSE culling / structured data", config);
-    print_results(get_results(data), config);
+static void generate_layers(Data *data, const Config &config)
+{
+    std::default_random_engine rng(config.seed);
+    std::uniform_int_distribution<int> layer(0, 7);
+    const int n = data->spheres.length();
+    uint32_t *layers = data->layers.append_uninitialized(n);
+    for (int i = 0; i < n; i++)
+        layers[i] = (1U << layer(rng)) | (i % 2 == 0 ? shadow_caster_layer : 0);
+}
 
-    data = generate_data(Random, config);
-    measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, "SSE culling / random data", config);
-    print_results(get_results(data), config);
+// The way it would be done without layer support in the kernel: a second pass
+// over the results which culls everything outside of the query.
+static void apply_layers(Slice<uint32_t> results, Slice<const uint32_t> layers, uint32_t query)
+{
+    for (int i = 0, n = layers.length; i < n; i++)
+        results.data[i / 32] |= (uint32_t)((layers.data[i] & query) == 0) << (i % 32);
+}
+
+enum LayerMode {
+    LayerUnfiltered,
+    LayerSecondPass,
+    LayerFused,
+};
+
+// args: mode, query mask
+static Stats run_layers(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    const uint32_t query = b.args[1];
+    Data data = generate_data(Structured, config);
+    generate_layers(&data, config);
+    // Filtering reads 4 more bytes per object, the second pass also reads and
+    // writes the results once more.
+    const int n = data.spheres.length();
+    const double layer_bytes = array_bytes(n) + n * sizeof(uint32_t);
+    const double result_bytes = data.results.length() * sizeof(uint32_t);
+    switch ((LayerMode)b.args[0]) {
+    case LayerUnfiltered:
+        stats = measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+        break;
+    case LayerSecondPass:
+        stats = measure([&]{ sse_cull(data.results, data.spheres, f); apply_layers(data.results, data.layers, query); },
+            50, 10, b.name, config, layer_bytes + 2 * result_bytes);
+        break;
+    case LayerFused:
+        stats = measure([&]{ sse_cull_masked(data.results, data.spheres, data.layers, query, f); },
+            50, 10, b.name, config, layer_bytes);
+        break;
+    }
+
+    int culled = 0;
+    for (int i = 0, n = data.spheres.length(); i < n; i++)
+        culled += (data.results[i / 32] >> (i % 32)) & 1;
+    printf("  visible: %.1f%%\n", (data.spheres.length() - culled) * 100.0 / data.spheres.length());
+    print_results(data.results, config);
+    return stats;
+}
+
+void register_arrays(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_array, {0, Structured}, "Naive culling / structured data");
+    add_benchmark(list, run_array, {0, Random}, "Naive culling / random data");
+    add_benchmark(list, run_array, {1, Structured}, "SSE culling / structured data");
+    add_benchmark(list, run_array, {1, Random}, "SSE culling / random data");
+
+    begin_group(list);
+    const int layer3 = 1 << 3;
+    const int shadow = (int)shadow_caster_layer;
+    add_benchmark(list, run_layers, {LayerUnfiltered, 0}, "Layer mask / unfiltered     / sse_cull");
+    add_benchmark(list, run_layers, {LayerSecondPass, layer3}, "Layer mask / layer 3       / sse_cull + second pass");
+    add_benchmark(list, run_layers, {LayerFused, layer3}, "Layer mask / layer 3       / fused");
+    add_benchmark(list, run_layers, {LayerSecondPass, shadow}, "Layer mask / shadow casters / sse_cull + second pass");
+    add_benchmark(list, run_layers, {LayerFused, shadow}, "Layer mask / shadow casters / fused");
 }
@@ -0,0 +1,71 @@
+#include "Bandwidth.h"
+#include "Timer.h"
+#include "Core/Vector.h"
+#include <emmintrin.h>
+
+// Four independent accumulators, otherwise the loop is bound by add latency
+// rather than memory.
+static float read_kernel(const float *a, int n)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        s0 = _mm_add_ps(s0, _mm_load_ps(a + i));
+        s1 = _mm_add_ps(s1, _mm_load_ps(a + i + 4));
+        s2 = _mm_add_ps(s2, _mm_load_ps(a + i + 8));
+        s3 = _mm_add_ps(s3, _mm_load_ps(a + i + 12));
+    }
+    float out[4];
+    _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+    return out[0] + out[1] + out[2] + out[3];
+}
+
+static void copy_kernel(float *a, const float *b, int n)
+{
+    for (int i = 0; i < n; i += 4)
+        _mm_store_ps(a + i, _mm_load_ps(b + i));
+}
+
+static void triad_kernel(float *a, const float *b, const float *c, float s, int n)
+{
+    const __m128 vs = _mm_set1_ps(s);
+    for (int i = 0; i < n; i += 4)
+        _mm_store_ps(a + i, _mm_add_ps(_mm_load_ps(b + i), _mm_mul_ps(vs, _mm_load_ps(c + i))));
+}
+
+// Best of a few runs after a warmup, as STREAM does.
+template <typename F>
+static double best_gbps(F &&f, double bytes)
+{
+    const int runs = 5;
+    double best = 1e30;
+    f();
+    for (int i = 0; i < runs; i++) {
+        const double begin = get_time_milliseconds();
+        f();
+        const double t = get_time_milliseconds() - begin;
+        if (t < best)
+            best = t;
+    }
+    return bytes / (best / 1000.0) / 1e9;
+}
+
+Bandwidth measure_bandwidth(int array_bytes)
+{
+    const int n = array_bytes / sizeof(float) / 16 * 16;
+    const double bytes = (double)n * sizeof(float);
+    Vector<float> a(&sse_allocator), b(&sse_allocator), c(&sse_allocator);
+    a.resize(n);
+    b.resize(n);
+    c.resize(n);
+    fill<float>(a, 1.0f);
+    fill<float>(b, 2.0f);
+    fill<float>(c, 0.5f);
+
+    Bandwidth bw;
+    volatile float sink = 0;
+    bw.read = best_gbps([&]{ sink = sink + read_kernel(a.data(), n); }, bytes);
+    bw.copy = best_gbps([&]{ copy_kernel(a.data(), b.data(), n); }, 2 * bytes);
+    bw.triad = best_gbps([&]{ triad_kernel(a.data(), b.data(), c.data(), 3.0f, n); }, 3 * bytes);
+    return bw;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Achievable memory bandwidth in GB/s measured with STREAM-style kernels on a
+// single thread. Byte counts follow STREAM: copy moves 2 and triad 3 arrays'
+// worth of bytes, write-allocate traffic is not counted.
+struct Bandwidth {
+    // Sum of an array, the closest to what culling kernels do.
+    double read = 0;
+    // a[i] = b[i]
+    double copy = 0;
+    // a[i] = b[i] + s * c[i]
+    double triad = 0;
+};
+
+// Each array is array_bytes big, it should be a few times larger than the last
+// level cache to measure DRAM bandwidth.
+Bandwidth measure_bandwidth(int array_bytes);
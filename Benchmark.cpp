@@ -0,0 +1,55 @@
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <regex>
+
+void begin_group(BenchmarkList *list)
+{
+    list->group++;
+}
+
+void add_benchmark(BenchmarkList *list, BenchmarkFunc run, std::initializer_list<int> args, const char *fmt, ...)
+{
+    NG_ASSERT(args.size() <= 4);
+    Benchmark *b = list->benchmarks.append();
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(b->name, sizeof(b->name), fmt, va);
+    va_end(va);
+    b->group = list->group;
+    b->run = run;
+    int i = 0;
+    for (int arg : args)
+        b->args[i++] = arg;
+    for (; i < 4; i++)
+        b->args[i] = 0;
+}
+
+void select_benchmarks(Vector<const Benchmark*> *out, const BenchmarkList &list, const Config &config)
+{
+    // Names are searched, not matched, "random" selects all random data cases.
+    std::regex filter(config.filter ? config.filter : "", std::regex::ECMAScript | std::regex::icase);
+    for (const Benchmark &b : list.benchmarks) {
+        if (!config.filter || std::regex_search(b.name, filter))
+            out->append(&b);
+    }
+}
+
+void run_benchmarks(const BenchmarkList &list, const Config &config)
+{
+    Vector<const Benchmark*> selected;
+    select_benchmarks(&selected, list, config);
+    int group = -1;
+    for (const Benchmark *b : selected) {
+        if (config.list) {
+            printf("%s\n", b->name);
+            continue;
+        }
+        if (group != -1 && group != b->group)
+            printf("----------------------------------------\n");
+        group = b->group;
+        memory_stats_reset();
+        b->run(*b, config);
+    }
+}
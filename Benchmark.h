@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Common.h"
+#include "Core/Vector.h"
+
+struct Benchmark;
+typedef Stats (*BenchmarkFunc)(const Benchmark &b, const Config &config);
+
+// A single benchmark case. Every case generates its own data, calls measure()
+// and prints its results, so any of them can be run in isolation. Returns the
+// stats of the main measured loop.
+struct Benchmark {
+    char name[256];
+    // Cases of one group are printed together, groups are separated by a line.
+    int group;
+    BenchmarkFunc run;
+    // Case parameters (kernel, data type, chunk size, ...), their meaning is up
+    // to the module which registered the case.
+    int args[4];
+};
+
+struct BenchmarkList {
+    Vector<Benchmark> benchmarks;
+    int group = 0;
+};
+
+// Starts a new group, following cases will be separated from previous ones.
+void begin_group(BenchmarkList *list);
+void add_benchmark(BenchmarkList *list, BenchmarkFunc run, std::initializer_list<int> args, const char *fmt, ...);
+
+// Benchmarks which match --filter, in registration order.
+void select_benchmarks(Vector<const Benchmark*> *out, const BenchmarkList &list, const Config &config);
+
+// Runs (or lists with --list) benchmarks which match --filter.
+void run_benchmarks(const BenchmarkList &list, const Config &config);
+
+// Runs benchmarks which match --filter over scene sizes from L1 resident to
+// many times the last level cache and prints a throughput table.
+void run_sweep(const BenchmarkList &list, const Config &config);
+
+void register_arrays(BenchmarkList *list);
+void register_chunks(BenchmarkList *list);
+void register_dynamic(BenchmarkList *list);
+void register_octree(BenchmarkList *list);
+void register_grid(BenchmarkList *list);
+void register_reorder(BenchmarkList *list);
+void register_scenes(BenchmarkList *list);
+void register_points(BenchmarkList *list);
+void register_lod(BenchmarkList *list);
+void register_depth_sort(BenchmarkList *list);
+void register_camera_paths(BenchmarkList *list, const Config &config);
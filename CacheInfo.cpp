@@ -0,0 +1,63 @@
+#include "CacheInfo.h"
+#include <stdio.h>
+#include <string.h>
+
+// Reads the first line of a file, returns false if there is none.
+static bool read_line(const char *path, char *buf, int size)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    const bool ok = fgets(buf, size, f) != nullptr;
+    fclose(f);
+    return ok;
+}
+
+// "48K" -> 49152
+static int parse_size(const char *s)
+{
+    char suffix = 0;
+    int n = 0;
+    if (sscanf(s, "%d%c", &n, &suffix) < 1)
+        return 0;
+    if (suffix == 'K')
+        return n * 1024;
+    if (suffix == 'M')
+        return n * 1024 * 1024;
+    return n;
+}
+
+CacheInfo detect_caches()
+{
+    CacheInfo info;
+    for (int i = 0; i < 16; i++) {
+        char path[256], level[16], type[32], size[32];
+        const char *base = "/sys/devices/system/cpu/cpu0/cache/index";
+        snprintf(path, sizeof(path), "%s%d/level", base, i);
+        if (!read_line(path, level, sizeof(level)))
+            break;
+        snprintf(path, sizeof(path), "%s%d/type", base, i);
+        if (!read_line(path, type, sizeof(type)) || strncmp(type, "Instruction", 11) == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s%d/size", base, i);
+        if (!read_line(path, size, sizeof(size)))
+            continue;
+        switch (level[0]) {
+        case '1': info.l1d = parse_size(size); break;
+        case '2': info.l2 = parse_size(size); break;
+        case '3': info.l3 = parse_size(size); break;
+        }
+    }
+
+    if (info.l1d == 0) {
+        info.l1d = 32 * 1024;
+        info.l2 = 256 * 1024;
+        info.l3 = 8 * 1024 * 1024;
+    }
+    return info;
+}
+
+int last_level_cache(const CacheInfo &info)
+{
+    return info.l3 != 0 ? info.l3 : info.l2 != 0 ? info.l2 : info.l1d;
+}
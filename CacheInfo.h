@@ -0,0 +1,13 @@
+#pragma once
+
+// Data cache sizes in bytes, 0 if the level doesn't exist.
+struct CacheInfo {
+    int l1d = 0;
+    int l2 = 0;
+    int l3 = 0;
+};
+
+// Reads cache sizes of the first CPU from sysfs on linux. If they can't be
+// detected, falls back to a typical desktop CPU: 32K L1d, 256K L2, 8M L3.
+CacheInfo detect_caches();
+int last_level_cache(const CacheInfo &info);
@@ -0,0 +1,167 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include "Scene.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <stdio.h>
+#include <string.h>
+
+// Camera looks down -z when yaw and pitch are zero, angles are in degrees.
+struct CameraKey {
+    Vec3f position;
+    float yaw;
+    float pitch;
+};
+
+enum PathType {
+    // Standing at the origin and turning around.
+    Orbit,
+    // Flying through the scene along -z, looking around a bit.
+    Flythrough,
+    // Loaded from --camera-path.
+    Recorded,
+};
+
+static const int frame_count = 240;
+
+static Quat key_orientation(const CameraKey &k)
+{
+    return Quat(Vec3f_Y(), k.yaw) * Quat(Vec3f_X(), k.pitch);
+}
+
+static void scripted_path(Vector<CameraKey> *keys, PathType type, float extent)
+{
+    switch (type) {
+    case Orbit:
+        for (int i = 0; i <= 8; i++)
+            keys->append({Vec3f(0), i * 45.0f, 0.0f});
+        break;
+    case Flythrough:
+        for (int i = 0; i <= 8; i++) {
+            const float t = i / 8.0f;
+            const float sway = i % 2 == 0 ? 1.0f : -1.0f;
+            keys->append({Vec3f(0, 0, lerp(extent, -extent, t)), sway * 20.0f, sway * 10.0f});
+        }
+        break;
+    case Recorded:
+        break;
+    }
+}
+
+// One key per line: x y z yaw pitch, lines starting with '#' are ignored.
+static void load_path(Vector<CameraKey> *keys, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        die("failed to open camera path %s", path);
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        CameraKey k;
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%f %f %f %f %f", &k.position.x, &k.position.y, &k.position.z, &k.yaw, &k.pitch) == 5)
+            keys->append(k);
+    }
+    fclose(f);
+    if (keys->length() == 0)
+        die("camera path %s has no keys", path);
+}
+
+// Samples frame_count frusta evenly along the keys.
+static void sample_frusta(Vector<Frustum> *frusta, Slice<const CameraKey> keys)
+{
+    const Frustum base = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    for (int i = 0; i < frame_count; i++) {
+        const float t = keys.length > 1 ? (float)i / (frame_count - 1) * (keys.length - 1) : 0.0f;
+        const int k = min((int)t, keys.length - 1);
+        const int k2 = min(k + 1, keys.length - 1);
+        const float frac = t - k;
+        const Vec3f position = lerp(keys[k].position, keys[k2].position, frac);
+        const Quat orientation = slerp(key_orientation(keys[k]), key_orientation(keys[k2]), frac);
+        frusta->append(transform(base, Transform(orientation, position)));
+    }
+}
+
+namespace {
+
+struct Data {
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    Vector<Frustum> frusta;
+    int frame = 0;
+};
+
+}
+
+static Data generate_data(const Config &config, PathType path, int scene)
+{
+    Data data;
+    std::default_random_engine rng(config.seed);
+    const SceneGenerator &g = scene_generators()[scene];
+    g.generate(&data.spheres, volume(Vec3i(config.data_size)), config.data_size, rng);
+    data.results.resize((data.spheres.length() + 31) / 32);
+
+    Vector<CameraKey> keys;
+    if (path == Recorded)
+        load_path(&keys, config.camera_path);
+    else
+        scripted_path(&keys, path, config.data_size);
+    sample_frusta(&data.frusta, keys);
+    return data;
+}
+
+static void print_visibility(Data *data)
+{
+    const int n = data->spheres.length();
+    int min_visible = n, max_visible = 0;
+    for (const Frustum &f : data->frusta) {
+        fill<uint32_t>(data->results, 0);
+        sse_cull(data->results, data->spheres, f);
+        int culled = 0;
+        for (int i = 0; i < n; i++)
+            culled += (data->results[i / 32] >> (i % 32)) & 1;
+        min_visible = min(min_visible, n - culled);
+        max_visible = max(max_visible, n - culled);
+    }
+    printf("  visible per frame: min %.1f%%, max %.1f%%\n", min_visible * 100.0 / n, max_visible * 100.0 / n);
+}
+
+// Every measured run is one frame, so the stats are the per-frame latency
+// distribution. Warmup and the minimum amount of runs are one full path.
+//
+// args: path type, scene generator index, 1 to use sse_cull
+static Stats run_camera_path(const Benchmark &b, const Config &config)
+{
+    Data data = generate_data(config, (PathType)b.args[0], b.args[1]);
+    auto frame = [&]{
+        const Frustum &f = data.frusta[data.frame++ % data.frusta.length()];
+        fill<uint32_t>(data.results, 0);
+        if (b.args[2] == 0)
+            naive_cull(data.results, data.spheres, f);
+        else
+            sse_cull(data.results, data.spheres, f);
+    };
+    const Stats stats = measure(frame, frame_count, frame_count, b.name, config);
+    print_visibility(&data);
+    return stats;
+}
+
+void register_camera_paths(BenchmarkList *list, const Config &config)
+{
+    const char *path_names[] = {"orbit", "flythrough", "recorded"};
+    const int paths = config.camera_path ? 3 : 2;
+    const Slice<const SceneGenerator> scenes = scene_generators();
+    for (int p = 0; p < paths; p++) {
+        begin_group(list);
+        for (int s = 0; s < scenes.length; s++) {
+            if (strcmp(scenes[s].name, "grid") != 0 && strcmp(scenes[s].name, "clustered") != 0)
+                continue;
+            add_benchmark(list, run_camera_path, {p, s, 0}, "Camera path / %-10s / %-9s / naive_cull",
+                path_names[p], scenes[s].name);
+            add_benchmark(list, run_camera_path, {p, s, 1}, "Camera path / %-10s / %-9s / sse_cull",
+                path_names[p], scenes[s].name);
+        }
+    }
+}
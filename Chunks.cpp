@@ -1,132 +1,490 @@
 #include "Common.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "MemoryStats.h"
 #include "Core/Vector.h"
 #include "Core/UniquePtr.h"
 #include "Math/Sphere.h"
 #include "Math/Frustum.h"
-#include <chrono>
 #include <random>
 #include <algorithm>
 
+enum ChunkOrder {
+    // Spheres are added to chunks in x-major order, chunks are long rows.
+    Linear,
+    // Spheres are sorted by Morton code of their grid position, chunks are
+    // compact bricks.
+    Morton,
+};
+
 struct Chunk {
-    Vector<Sphere> spheres = Vector<Sphere>(&sse_allocator);
-    Vector<uint32_t> results;
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    Vec3f bounds_min;
+    Vec3f bounds_max;
 
     Chunk(int max)
     {
             spheres.reserve(max);
-            results.resize(max + 31 / 32);
+            results.resize((max + 31) / 32);
             fill<uint32_t>(results, 0);
     }
+
+    // Chunk objects themselves are accounted as chunk headers.
+    static void *operator new(size_t size) { return chunk_header_memory.allocate_bytes(size); }
+    static void operator delete(void *ptr) { chunk_header_memory.free_bytes(ptr); }
+};
+
+// Whole chunk in one cache line aligned block: this header, result words
+// (padded to 16 bytes) and then the spheres. With up to 256 spheres per chunk
+// the header and the results share the first cache line, so culling a chunk
+// touches one contiguous range instead of three separate allocations.
+struct InlineChunk {
+    int count;
+    int words;
+    Vec3f bounds_min;
+    Vec3f bounds_max;
+
+    static int results_bytes(int count) { return ((count + 31) / 32 * 4 + 15) & ~15; }
+
+    uint32_t *results() { return reinterpret_cast<uint32_t*>(this + 1); }
+    const uint32_t *results() const { return reinterpret_cast<const uint32_t*>(this + 1); }
+    Sphere *spheres() { return reinterpret_cast<Sphere*>(reinterpret_cast<char*>(this + 1) + results_bytes(count)); }
+    const Sphere *spheres() const { return reinterpret_cast<const Sphere*>(reinterpret_cast<const char*>(this + 1) + results_bytes(count)); }
+};
+
+static_assert(sizeof(InlineChunk) % 16 == 0, "spheres after InlineChunk must stay 16 byte aligned");
+
+struct InlineChunkDelete {
+    static void invoke(InlineChunk *c) { inline_chunk_memory.free_bytes(c); }
+};
+
+static InlineChunk *new_inline_chunk(const Chunk &c)
+{
+    const int count = c.spheres.length();
+    const int bytes = sizeof(InlineChunk) + InlineChunk::results_bytes(count) + count * sizeof(Sphere);
+    InlineChunk *ic = reinterpret_cast<InlineChunk*>(inline_chunk_memory.allocate_bytes(bytes));
+    ic->count = count;
+    ic->words = (count + 31) / 32;
+    ic->bounds_min = c.bounds_min;
+    ic->bounds_max = c.bounds_max;
+    copy_memory(ic->results(), c.results.data(), ic->words);
+    copy_memory(ic->spheres(), c.spheres.data(), count);
+    return ic;
+}
+
+// Everything the kernels need to know about a chunk, stored by value in visit
+// order. Walking the table is a sequential read, so the record of chunk i + k
+// is already at hand (and its prefetches can be issued) without going through
+// a Chunk pointer first.
+struct ChunkRecord {
+    const Sphere *spheres;
+    uint32_t *results;
+    int count;
+    Vec3f bounds_min;
+    Vec3f bounds_max;
 };
 
+namespace {
+
 struct Data {
-    Vector<UniquePtr<Chunk>> chunks_ordered;
-    Vector<Chunk*> chunks;
+    Vector<UniquePtr<Chunk>> chunks_ordered = Vector<UniquePtr<Chunk>>(&chunk_header_memory);
+    Vector<Chunk*> chunks = Vector<Chunk*>(&chunk_header_memory);
+    // chunks[i] is chunks_ordered[order[i]].
+    Vector<int> order;
+
+    // Same chunks in the InlineChunk layout, see make_inline().
+    Vector<UniquePtr<InlineChunk, InlineChunkDelete>> inline_ordered =
+        Vector<UniquePtr<InlineChunk, InlineChunkDelete>>(&chunk_header_memory);
+    Vector<InlineChunk*> inline_chunks = Vector<InlineChunk*>(&chunk_header_memory);
+
+    // Records of chunks in the same order as chunks, see make_table().
+    Vector<ChunkRecord> table = Vector<ChunkRecord>(&chunk_header_memory);
+
+    // Maps sphere position within chunks_ordered (as if all chunks were
+    // concatenated) to its 3d position (offset_3d(Vec3i(x, y, z), Vec3i(data_size)).
+    Vector<int> mapping = Vector<int>(&mapping_memory);
 };
 
-static Data generate_data(DataType data_type, const Config &config, int max)
+}
+
+static Data generate_data(DataType data_type, const Config &config, int max, ChunkOrder order = Linear)
 {
     Data data;
-    data.chunks_ordered.pappend(new (OrDie) Chunk(max));
-    Chunk *c = data.chunks_ordered.last().get();
-    const int half_size = config.data_size/2;
+    const Vec3i size(config.data_size);
+    Vector<uint64_t> keys;
+    uint64_t *k = keys.append_uninitialized(volume(size));
     for (int z = 0; z < config.data_size; z++) {
     for (int y = 0; y < config.data_size; y++) {
     for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p(x, y, z);
+        const uint64_t key = order == Morton ? morton_encode(p) : 0;
+        *k++ = (key << 32) | offset_3d(p, size);
+    }}}
+    if (order == Morton)
+        sort(keys.sub());
+
+    data.mapping.reserve(keys.length());
+    data.chunks_ordered.pappend(new Chunk(max));
+    Chunk *c = data.chunks_ordered.last().get();
+    const int half_size = config.data_size/2;
+    for (uint64_t key : keys) {
+        const int offset = key & 0xFFFFFFFF;
+        const int x = offset % size.x;
+        const int y = offset / size.x % size.y;
+        const int z = offset / (size.x * size.y);
         const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
         c->spheres.pappend(ToVec3f(p), 1.0f);
+        data.mapping.append(offset);
         if (c->spheres.length() == max) {
-            data.chunks_ordered.pappend(new (OrDie) Chunk(max));
+            data.chunks_ordered.pappend(new Chunk(max));
             c = data.chunks_ordered.last().get();
         }
-    }}}
+    }
 
     if (data.chunks_ordered.last()->spheres.length() == 0)
         data.chunks_ordered.resize(data.chunks_ordered.length() - 1);
 
+    for (const auto &c : data.chunks_ordered)
+        sse_sphere_bounds(c->spheres, &c->bounds_min, &c->bounds_max);
+
+    data.order.resize(data.chunks_ordered.length());
+    for (int i = 0; i < data.order.length(); i++)
+        data.order[i] = i;
+    if (data_type == Random) {
+        std::shuffle(data.order.data(), data.order.data() + data.order.length(),
+            std::default_random_engine(config.seed));
+    }
+
     data.chunks.resize(data.chunks_ordered.length());
     for (int i = 0; i < data.chunks.length(); i++) {
-        data.chunks[i] = data.chunks_ordered[i].get();
+        data.chunks[i] = data.chunks_ordered[data.order[i]].get();
     }
+    return data;
+}
 
-    if (data_type == Random) {
-        auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-        std::shuffle(data.chunks.data(), data.chunks.data() + data.chunks.length(),
-            std::default_random_engine(seed));
+static void make_table(Data *data)
+{
+    ChunkRecord *r = data->table.append_uninitialized(data->chunks.length());
+    for (Chunk *c : data->chunks) {
+        r->spheres = c->spheres.data();
+        r->results = c->results.data();
+        r->count = c->spheres.length();
+        r->bounds_min = c->bounds_min;
+        r->bounds_max = c->bounds_max;
+        r++;
     }
-    return data;
 }
 
-static Vector<uint32_t> get_results(const Data &data)
+// Converts all the chunks to InlineChunk, allocated in the same order as
+// chunks_ordered and visited in the same order as chunks. Regular chunks are
+// freed, so that memory stats only show the inline layout.
+static void make_inline(Data *data)
 {
-    int count = 0;
-    for (const auto &c : data.chunks_ordered)
-        count += c->spheres.length();
+    for (const auto &c : data->chunks_ordered)
+        data->inline_ordered.pappend(new_inline_chunk(*c));
+    data->inline_chunks.resize(data->inline_ordered.length());
+    for (int i = 0; i < data->inline_chunks.length(); i++)
+        data->inline_chunks[i] = data->inline_ordered[data->order[i]].get();
 
-    Vector<uint32_t> out(count + 31 / 32);
+    data->chunks.clear();
+    data->chunks.shrink();
+    data->chunks_ordered.clear();
+    data->chunks_ordered.shrink();
+}
+
+static Vector<uint32_t> get_results(const Data &data)
+{
+    Vector<uint32_t> out((data.mapping.length() + 31) / 32);
     fill<uint32_t>(out, 0);
     int out_i = 0;
-    for (const auto &c : data.chunks_ordered) {
-        for (int i = 0, n = c->spheres.length(); i < n; i++) {
+    auto gather = [&](const uint32_t *results, int n) {
+        for (int i = 0; i < n; i++) {
             const int ri = i / 32;
             const int shift = i % 32;
-            const int out_ri = out_i / 32;
-            const int out_shift = out_i % 32;
-            const uint32_t result = (c->results[ri] & (1U << shift)) != 0;
+            const int out_ri = data.mapping[out_i] / 32;
+            const int out_shift = data.mapping[out_i] % 32;
+            const uint32_t result = (results[ri] & (1U << shift)) != 0;
             out[out_ri] |= (result & 1) << out_shift;
             out_i++;
         }
-    }
+    };
+    for (const auto &c : data.chunks_ordered)
+        gather(c->results.data(), c->spheres.length());
+    for (const auto &c : data.inline_ordered)
+        gather(c->results(), c->count);
     return out;
 }
 
+// Bytes a run streams through in whichever layout is live: chunk pointers or
+// table records, chunk headers, spheres and the result words of every chunk.
+static double chunk_bytes(const Data &data)
+{
+    // Table kernels read records instead of chunk pointers and headers.
+    const double header = data.table.length() > 0 ? sizeof(ChunkRecord) : sizeof(Chunk*) + sizeof(Chunk);
+    double bytes = 0;
+    for (const Chunk *c : data.chunks)
+        bytes += header + c->spheres.length() * sizeof(Sphere) + c->results.length() * sizeof(uint32_t);
+    for (const InlineChunk *c : data.inline_chunks)
+        bytes += sizeof(InlineChunk*) + sizeof(InlineChunk) + InlineChunk::results_bytes(c->count) + c->count * sizeof(Sphere);
+    return bytes;
+}
+
 static void sse_cull_data(Data *data, const Frustum &f)
 {
+    TRACE_SCOPE("chunk batch");
     for (const auto &c : data->chunks)
         sse_cull(c->results, c->spheres, f);
 }
 
 static void sse_cull_data_prefetch(Data *data, const Frustum &f)
 {
+    TRACE_SCOPE("chunk batch");
     for (int i = 0, n = data->chunks.length(); i < n; i++) {
         if (i != n-1) {
             // Tried all hints there, NTA works best for very fragmented data.
             _mm_prefetch(reinterpret_cast<const char*>(data->chunks.data()[i+1]->spheres.data()), _MM_HINT_NTA);
             _mm_prefetch(reinterpret_cast<const char*>(data->chunks.data()[i+1]->results.data()), _MM_HINT_NTA);
+            CULL_STAT(prefetches, 2);
         }
         const auto &c = data->chunks.data()[i];
         sse_cull(c->results, c->spheres, f);
     }
 }
 
-void do_chunks(const Config &config)
+// Chunks completely inside or outside of the frustum skip per-sphere tests.
+static void sse_cull_data_bounds(Data *data, const Frustum &f)
 {
-    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
-    Data data;
+    TRACE_SCOPE("chunk batch");
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    for (const auto &c : data->chunks) {
+        switch (sse_cull_box(planes, c->bounds_min, c->bounds_max)) {
+        case FS_OUTSIDE:
+            CULL_STAT(chunks_rejected, 1);
+            fill_bits(c->results, 0, c->spheres.length(), true);
+            break;
+        case FS_INSIDE:
+            CULL_STAT(chunks_accepted, 1);
+            fill_bits(c->results, 0, c->spheres.length(), false);
+            break;
+        case FS_BOTH:
+            CULL_STAT(chunks_tested, 1);
+            fill_bits(c->results, 0, c->spheres.length(), false);
+            sse_cull(c->results, c->spheres, f);
+            break;
+        }
+    }
+}
 
-    auto just_do_it = [&](int N) {
-        char buf[4096];
-        snprintf(buf, sizeof(buf), "%03d", N);
+static void inline_cull_data(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    for (InlineChunk *c : data->inline_chunks)
+        sse_cull(Slice<uint32_t>(c->results(), c->words), Slice<const Sphere>(c->spheres(), c->count), f);
+}
 
-        snprintf(buf, sizeof(buf), "SSE culling / chunks / structured data / %3d per chunk (w/o  prefetch)", N);
-        data = generate_data(Structured, config, N);
-        measure([&]{ sse_cull_data(&data, f); }, 50, 10, buf, config);
-        print_results(get_results(data), config);
+// One prefetch for the header and results, one for the first spheres. The
+// second one mostly matters for chunks bigger than 256 spheres, where the
+// results spill out of the first line.
+static void inline_cull_data_prefetch(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    for (int i = 0, n = data->inline_chunks.length(); i < n; i++) {
+        if (i != n-1) {
+            const InlineChunk *next = data->inline_chunks.data()[i+1];
+            _mm_prefetch(reinterpret_cast<const char*>(next), _MM_HINT_NTA);
+            _mm_prefetch(reinterpret_cast<const char*>(next->spheres()), _MM_HINT_NTA);
+            CULL_STAT(prefetches, 2);
+        }
+        InlineChunk *c = data->inline_chunks.data()[i];
+        sse_cull(Slice<uint32_t>(c->results(), c->words), Slice<const Sphere>(c->spheres(), c->count), f);
+    }
+}
 
-        snprintf(buf, sizeof(buf), "SSE culling / chunks / random data     / %3d per chunk (w/o  prefetch)", N);
-        data = generate_data(Random, config, N);
-        measure([&]{ sse_cull_data(&data, f); }, 50, 10, buf, config);
-        print_results(get_results(data), config);
+static void inline_cull_data_bounds(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    for (InlineChunk *c : data->inline_chunks) {
+        const Slice<uint32_t> results(c->results(), c->words);
+        switch (sse_cull_box(planes, c->bounds_min, c->bounds_max)) {
+        case FS_OUTSIDE:
+            CULL_STAT(chunks_rejected, 1);
+            fill_bits(results, 0, c->count, true);
+            break;
+        case FS_INSIDE:
+            CULL_STAT(chunks_accepted, 1);
+            fill_bits(results, 0, c->count, false);
+            break;
+        case FS_BOTH:
+            CULL_STAT(chunks_tested, 1);
+            fill_bits(results, 0, c->count, false);
+            sse_cull(results, Slice<const Sphere>(c->spheres(), c->count), f);
+            break;
+        }
+    }
+}
 
-        snprintf(buf, sizeof(buf), "SSE culling / chunks / random data     / %3d per chunk (with prefetch)", N);
-        data = generate_data(Random, config, N);
-        measure([&]{ sse_cull_data_prefetch(&data, f); }, 50, 10, buf, config);
-        print_results(get_results(data), config);
-    };
+static void table_cull_data(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    for (const ChunkRecord &r : data->table)
+        sse_cull(Slice<uint32_t>(r.results, (r.count + 31) / 32), Slice<const Sphere>(r.spheres, r.count), f);
+}
 
-    const int tries[] = {512, 256, 128, 64, 32, 8};
-    for (int t : tries) {
-        printf("----------------------------------------\n");
-        just_do_it(t);
+// How many chunks ahead to prefetch. One chunk of lookahead is what the
+// pointer array version can afford, the table can go further since the
+// addresses don't depend on any other loads.
+static const int table_prefetch_distance = 4;
+
+static void table_cull_data_prefetch(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    const ChunkRecord *table = data->table.data();
+    for (int i = 0, n = data->table.length(); i < n; i++) {
+        if (i + table_prefetch_distance < n) {
+            const ChunkRecord &next = table[i + table_prefetch_distance];
+            _mm_prefetch(reinterpret_cast<const char*>(next.spheres), _MM_HINT_NTA);
+            _mm_prefetch(reinterpret_cast<const char*>(next.results), _MM_HINT_NTA);
+            CULL_STAT(prefetches, 2);
+        }
+        const ChunkRecord &r = table[i];
+        sse_cull(Slice<uint32_t>(r.results, (r.count + 31) / 32), Slice<const Sphere>(r.spheres, r.count), f);
+    }
+}
+
+// Bounds are part of the record, rejected and accepted chunks never touch
+// anything but the table and their results.
+static void table_cull_data_bounds(Data *data, const Frustum &f)
+{
+    TRACE_SCOPE("chunk batch");
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    for (const ChunkRecord &r : data->table) {
+        const Slice<uint32_t> results(r.results, (r.count + 31) / 32);
+        switch (sse_cull_box(planes, r.bounds_min, r.bounds_max)) {
+        case FS_OUTSIDE:
+            CULL_STAT(chunks_rejected, 1);
+            fill_bits(results, 0, r.count, true);
+            break;
+        case FS_INSIDE:
+            CULL_STAT(chunks_accepted, 1);
+            fill_bits(results, 0, r.count, false);
+            break;
+        case FS_BOTH:
+            CULL_STAT(chunks_tested, 1);
+            fill_bits(results, 0, r.count, false);
+            sse_cull(results, Slice<const Sphere>(r.spheres, r.count), f);
+            break;
+        }
+    }
+}
+
+static void print_chunk_stats(const Data &data, const Frustum &f)
+{
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    int counts[3] = {};
+    double volume_sum = 0;
+    for (const auto &c : data.chunks) {
+        counts[sse_cull_box(planes, c->bounds_min, c->bounds_max)]++;
+        volume_sum += volume(c->bounds_max - c->bounds_min);
+    }
+    const double n = data.chunks.length();
+    printf("  %d chunks, average bounds volume: %.1f, inside: %.1f%%, outside: %.1f%%, both: %.1f%%\n",
+        data.chunks.length(), volume_sum / n,
+        counts[FS_INSIDE] * 100.0 / n, counts[FS_OUTSIDE] * 100.0 / n, counts[FS_BOTH] * 100.0 / n);
+}
+
+enum ChunkKernel {
+    Plain,
+    Prefetch,
+    Bounds,
+    InlinePlain,
+    InlinePrefetch,
+    InlineBounds,
+    TablePlain,
+    TablePrefetch,
+    TableBounds,
+};
+
+// args: data type, chunk size, kernel, chunk order
+static Stats run_chunks(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    Data data = generate_data((DataType)b.args[0], config, b.args[1], (ChunkOrder)b.args[3]);
+    switch ((ChunkKernel)b.args[2]) {
+    case Plain:
+        stats = measure([&]{ sse_cull_data(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case Prefetch:
+        stats = measure([&]{ sse_cull_data_prefetch(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case Bounds:
+        stats = measure([&]{ sse_cull_data_bounds(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        print_chunk_stats(data, f);
+        break;
+    case InlinePlain:
+        make_inline(&data);
+        stats = measure([&]{ inline_cull_data(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case InlinePrefetch:
+        make_inline(&data);
+        stats = measure([&]{ inline_cull_data_prefetch(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case InlineBounds:
+        print_chunk_stats(data, f);
+        make_inline(&data);
+        stats = measure([&]{ inline_cull_data_bounds(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case TablePlain:
+        make_table(&data);
+        stats = measure([&]{ table_cull_data(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case TablePrefetch:
+        make_table(&data);
+        stats = measure([&]{ table_cull_data_prefetch(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    case TableBounds:
+        make_table(&data);
+        stats = measure([&]{ table_cull_data_bounds(&data, f); }, 50, 10, b.name, config, chunk_bytes(data));
+        break;
+    }
+    print_results(get_results(data), config);
+    return stats;
+}
+
+void register_chunks(BenchmarkList *list)
+{
+    const int sizes[] = {512, 256, 128, 64, 32, 8};
+    for (int n : sizes) {
+        begin_group(list);
+        add_benchmark(list, run_chunks, {Structured, n, Plain, Linear},
+            "SSE culling / chunks / structured data / %3d per chunk (w/o  prefetch)", n);
+        add_benchmark(list, run_chunks, {Random, n, Plain, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (w/o  prefetch)", n);
+        add_benchmark(list, run_chunks, {Random, n, Prefetch, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (with prefetch)", n);
+        add_benchmark(list, run_chunks, {Structured, n, Bounds, Linear},
+            "SSE culling / chunks / structured data / %3d per chunk (linear, bounds)", n);
+        add_benchmark(list, run_chunks, {Structured, n, Bounds, Morton},
+            "SSE culling / chunks / structured data / %3d per chunk (morton, bounds)", n);
+        add_benchmark(list, run_chunks, {Structured, n, InlinePlain, Linear},
+            "SSE culling / chunks / structured data / %3d per chunk (inline, w/o  prefetch)", n);
+        add_benchmark(list, run_chunks, {Random, n, InlinePlain, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (inline, w/o  prefetch)", n);
+        add_benchmark(list, run_chunks, {Random, n, InlinePrefetch, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (inline, with prefetch)", n);
+        add_benchmark(list, run_chunks, {Structured, n, InlineBounds, Morton},
+            "SSE culling / chunks / structured data / %3d per chunk (inline, morton, bounds)", n);
+        add_benchmark(list, run_chunks, {Random, n, TablePlain, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (table, w/o  prefetch)", n);
+        add_benchmark(list, run_chunks, {Random, n, TablePrefetch, Linear},
+            "SSE culling / chunks / random data     / %3d per chunk (table, with prefetch)", n);
+        add_benchmark(list, run_chunks, {Structured, n, TableBounds, Morton},
+            "SSE culling / chunks / structured data / %3d per chunk (table, morton, bounds)", n);
     }
 }
@@ -1,7 +1,13 @@
 #include "Common.h"
 #include "Timer.h"
+#include "Report.h"
+#include "Perf.h"
+#include "Histogram.h"
+#include "Trace.h"
+#include "MemoryStats.h"
 #include "Core/Vector.h"
 #include <stdio.h>
+#include <math.h>
 
 void parse_args(Config *config, int argc, char **argv)
 {
@@ -9,8 +15,46 @@ void parse_args(Config *config, int argc, char **argv)
         const char *arg = argv[i];
         if (strcmp(arg, "-v") == 0) {
             config->verbose = true;
-        } else if (strcmp(arg, "-s") == 0) {
+        } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--size") == 0) {
             config->data_size = atoi(argv[++i]);
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            config->threads = max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "--seed") == 0) {
+            config->seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            config->warmup = max(0, atoi(argv[++i]));
+        } else if (strcmp(arg, "--runs") == 0) {
+            config->runs = max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "--camera-path") == 0) {
+            config->camera_path = argv[++i];
+        } else if (strcmp(arg, "--filter") == 0) {
+            config->filter = argv[++i];
+        } else if (strcmp(arg, "--list") == 0) {
+            config->list = true;
+        } else if (strcmp(arg, "--sweep") == 0) {
+            config->sweep = true;
+        } else if (strcmp(arg, "--budget") == 0) {
+            config->time_budget = atof(argv[++i]);
+        } else if (strcmp(arg, "--ci") == 0) {
+            config->target_ci = atof(argv[++i]);
+        } else if (strcmp(arg, "--no-bandwidth") == 0) {
+            config->bandwidth_probe = false;
+        } else if (strcmp(arg, "--antagonist-copy") == 0) {
+            config->antagonist_streaming = max(0, atoi(argv[++i]));
+            config->histogram = true;
+        } else if (strcmp(arg, "--antagonist-chase") == 0) {
+            config->antagonist_chasing = max(0, atoi(argv[++i]));
+            config->histogram = true;
+        } else if (strcmp(arg, "--histogram") == 0) {
+            config->histogram = true;
+        } else if (strcmp(arg, "--perf") == 0) {
+            config->perf = true;
+        } else if (strcmp(arg, "--trace") == 0) {
+            config->trace_path = argv[++i];
+        } else if (strcmp(arg, "--csv") == 0) {
+            config->csv_path = argv[++i];
+        } else if (strcmp(arg, "--json") == 0) {
+            config->json_path = argv[++i];
         }
     }
 }
@@ -37,32 +81,238 @@ void print_results(Slice<const uint32_t> bits, const Config &config)
     }
 }
 
-void measure(Func<void()> f, int warmup, int runs, const char *name, const Config &config)
+void fill_bits(Slice<uint32_t> bits, int begin, int end, bool value)
 {
-    Vector<double> results(runs);
+    if (begin >= end)
+        return;
+    const int first = begin / 32;
+    const int last = (end - 1) / 32;
+    const uint32_t first_mask = 0xFFFFFFFFU << (begin % 32);
+    const uint32_t last_mask = 0xFFFFFFFFU >> (31 - (end - 1) % 32);
+    const uint32_t v = value ? 0xFFFFFFFFU : 0;
+    if (first == last) {
+        const uint32_t mask = first_mask & last_mask;
+        bits.data[first] = (bits.data[first] & ~mask) | (v & mask);
+        return;
+    }
+    bits.data[first] = (bits.data[first] & ~first_mask) | (v & first_mask);
+    for (int i = first + 1; i < last; i++)
+        bits.data[i] = v;
+    bits.data[last] = (bits.data[last] & ~last_mask) | (v & last_mask);
+}
+
+Stats measure(Func<void()> f, int warmup, int runs, const char *name, const Config &config,
+    double bytes_per_run)
+{
+    // Runs until the 95% confidence interval of the mean is within target_ci
+    // percent of the mean, but at least `runs` times and for no longer than
+    // time_budget milliseconds (unless that's less than `runs`). Exactly
+    // config.runs times if that is set.
+    const int max_runs = 100000;
+    const bool fixed_runs = config.runs > 0;
+    if (config.warmup >= 0)
+        warmup = config.warmup;
+    if (fixed_runs)
+        runs = config.runs;
+    Vector<double> results;
     for (int i = 0; i < warmup; i++) {
+        TRACE_SCOPE("warmup");
         f();
     }
-    double average = get_time_milliseconds();
-    for (int i = 0; i < runs; i++) {
-        const double begin = get_time_milliseconds();
-        f();
-        results[i] = get_time_milliseconds() - begin;
+    // Drop whatever was counted during warmup.
+    CullStats discarded;
+    cull_stats_collect(&discarded);
+    if (config.perf)
+        perf_start();
+    // Running sums are enough for the stopping criterion, full stats are
+    // computed once at the end.
+    double sum = 0, sum_sq = 0;
+    // Latencies in nanoseconds, recorded as they come.
+    Histogram histogram;
+    const uint64_t start = tsc_begin();
+    for (;;) {
+        const uint64_t begin = tsc_begin();
+        {
+            TRACE_SCOPE(name);
+            f();
+        }
+        const uint64_t end = tsc_end();
+        const double t = tsc_to_milliseconds(end - begin);
+        results.append(t);
+        if (config.histogram)
+            histogram_record(&histogram, (uint64_t)(t * 1e6));
+        sum += t;
+        sum_sq += t * t;
+
+        const int n = results.length();
+        if (n < runs)
+            continue;
+        if (fixed_runs || n >= max_runs || tsc_to_milliseconds(end - start) >= config.time_budget)
+            break;
+        if (n > 1) {
+            const double mean = sum / n;
+            const double variance = max(0.0, (sum_sq - sum * mean) / (n - 1));
+            if (student_t95(n - 1) * sqrt(variance / n) <= mean * config.target_ci / 100.0)
+                break;
+        }
     }
-    average = (get_time_milliseconds() - average) / runs;
-    printf("'%s' done in %d runs, average: %fms\n", name, runs, average);
+    PerfValues perf;
+    if (config.perf)
+        perf_stop(&perf);
+    CullStats cull_stats;
+    const bool has_cull_stats = cull_stats_collect(&cull_stats);
+    const Stats stats = compute_stats(results);
+
+    printf("'%s' done in %d runs, average: %fms\n", name, stats.count, stats.mean);
+    printf("    median: %fms, min: %fms, p90: %fms, p99: %fms, stddev: %fms, ci95: +-%fms (%.2f%%)\n",
+        stats.median, stats.min, stats.p90, stats.p99, stats.stddev, stats.ci95,
+        stats.mean > 0 ? stats.ci95 / stats.mean * 100.0 : 0.0);
     if (config.verbose) {
         printf("per-run info:\n");
-        for (int i = 0; i < runs; i++)
+        for (int i = 0; i < results.length(); i++)
             printf(" [%d] %fms\n", i, results[i]);
     }
+
+    if (config.histogram) {
+        printf("    histogram: p50: %fms, p90: %fms, p99: %fms, p99.9: %fms, p99.99: %fms, max: %fms\n",
+            histogram_percentile(histogram, 50) / 1e6, histogram_percentile(histogram, 90) / 1e6,
+            histogram_percentile(histogram, 99) / 1e6, histogram_percentile(histogram, 99.9) / 1e6,
+            histogram_percentile(histogram, 99.99) / 1e6, histogram.max / 1e6);
+        if (config.verbose)
+            print_histogram(histogram, 1e6, "ms");
+    }
+
+    if (has_cull_stats) {
+        const double runs = stats.count;
+        const uint64_t *e = cull_stats.early_outs;
+        printf("    per frame: %.0f spheres tested, %.0f plane evaluations, early-outs by plane: %.0f %.0f %.0f %.0f %.0f %.0f\n",
+            cull_stats.spheres_tested / runs, cull_stats.plane_evaluations / runs,
+            e[0] / runs, e[1] / runs, e[2] / runs, e[3] / runs, e[4] / runs, e[5] / runs);
+        printf("    per frame: chunks accepted %.0f, rejected %.0f, tested %.0f, %.0f prefetches\n",
+            cull_stats.chunks_accepted / runs, cull_stats.chunks_rejected / runs,
+            cull_stats.chunks_tested / runs, cull_stats.prefetches / runs);
+        const uint64_t rejections = cull_stats.frustum_rejections + cull_stats.contribution_rejections +
+            cull_stats.distance_rejections;
+        if (rejections > 0) {
+            printf("    per frame: rejected by frustum %.0f, contribution %.0f, distance %.0f\n",
+                cull_stats.frustum_rejections / runs, cull_stats.contribution_rejections / runs,
+                cull_stats.distance_rejections / runs);
+        }
+    }
+
+    // Throughput is nominal: every run is assumed to stream bytes_per_run once,
+    // which is all the spheres and result bits unless the caller knows better.
+    // Kernels which skip data (bounds, octree, grid) can go above 100% of the
+    // measured bandwidth.
+    const double scene_objects = volume(Vec3i(config.data_size));
+    const double scene_bytes = bytes_per_run > 0 ? bytes_per_run : array_bytes(scene_objects);
+    const double spheres_per_second = scene_objects / (stats.mean / 1000.0);
+    const double gbps = scene_bytes / (stats.mean / 1000.0) / 1e9;
+    const double cycles_per_sphere = stats.mean * tsc_ticks_per_millisecond() / scene_objects;
+    printf("    %.1fM spheres/s, %.2f TSC cycles/sphere, %.2f GB/s", spheres_per_second / 1e6, cycles_per_sphere, gbps);
+    if (config.bandwidth > 0)
+        printf(" (%.1f%% of measured bandwidth)", gbps / config.bandwidth * 100.0);
+    printf("\n");
+
+    // Only benchmarks which allocate their scene with tagged allocators (see
+    // MemoryStats.h) have anything to show here, tags without live memory are
+    // left out.
+    const int64_t live_bytes = memory_live_bytes();
+    const int64_t peak_bytes = memory_peak_bytes();
+    int64_t allocations = 0, alignment_waste = 0;
+    if (live_bytes > 0) {
+        printf("    memory: %.2f bytes/object (", live_bytes / scene_objects);
+        const char *separator = "";
+        for (int i = 0; i < MT_COUNT; i++) {
+            const MemoryTagStats &s = memory_stats((MemoryTag)i);
+            if (s.live_bytes > 0) {
+                printf("%s%s %.2f", separator, memory_tag_name((MemoryTag)i), s.live_bytes / scene_objects);
+                separator = ", ";
+            }
+            allocations += s.allocations;
+            alignment_waste += s.alignment_waste;
+        }
+        printf("), peak %.2f bytes/object, %lld allocations, %lld bytes of alignment waste\n",
+            peak_bytes / scene_objects, (long long)allocations, (long long)alignment_waste);
+    }
+
+    // Per sphere in the scene, averaged over all the runs.
+    const double objects = scene_objects * stats.count;
+    if (config.perf) {
+        const char *sep = " ";
+        printf("    per sphere:");
+        for (int i = 0; i < PC_COUNT; i++) {
+            if (!perf.valid[i])
+                continue;
+            printf("%s%s: %.3f", sep, perf_counter_name((PerfCounter)i), perf.values[i] / objects);
+            sep = ", ";
+        }
+        if (perf.valid[PC_CYCLES] && perf.valid[PC_INSTRUCTIONS] && perf.values[PC_CYCLES] > 0)
+            printf("%sIPC: %.2f", sep, perf.values[PC_INSTRUCTIONS] / perf.values[PC_CYCLES]);
+        printf("\n");
+    }
+
+    const ReportField timing_fields[] = {
+        {"runs", (double)stats.count},
+        {"mean_ms", stats.mean},
+        {"median_ms", stats.median},
+        {"min_ms", stats.min},
+        {"max_ms", stats.max},
+        {"p90_ms", stats.p90},
+        {"p99_ms", stats.p99},
+        {"stddev_ms", stats.stddev},
+        {"ci95_ms", stats.ci95},
+        {"spheres_per_s", spheres_per_second},
+        {"tsc_cycles_per_sphere", cycles_per_sphere},
+        {"gb_per_s", gbps},
+    };
+    Vector<ReportField> fields;
+    fields.append(Slice<const ReportField>(timing_fields));
+    if (config.histogram) {
+        fields.append({"hist_p99_ms", histogram_percentile(histogram, 99) / 1e6});
+        fields.append({"hist_p999_ms", histogram_percentile(histogram, 99.9) / 1e6});
+        fields.append({"hist_p9999_ms", histogram_percentile(histogram, 99.99) / 1e6});
+    }
+    if (config.bandwidth > 0)
+        fields.append({"bandwidth_percent", gbps / config.bandwidth * 100.0});
+    // Every record of a run must have the same fields, see Report.h. Untracked
+    // memory is 0, counters which failed to open are written as empty values.
+    fields.append({"bytes_per_object", live_bytes / scene_objects});
+    fields.append({"peak_bytes_per_object", peak_bytes / scene_objects});
+    if (config.perf) {
+        for (int i = 0; i < PC_COUNT; i++)
+            fields.append({perf_counter_name((PerfCounter)i), perf.valid[i] ? perf.values[i] / objects : NAN});
+    }
+    report(name, fields);
+    return stats;
 }
 
+#if defined(SSECULLING_STATS)
+// Same as Frustum::cull, but counts evaluated planes.
+static uint32_t naive_cull_sphere_stats(const Frustum &f, const Sphere &s)
+{
+    for (int i = 0; i < 6; i++) {
+        const Plane &p = f.planes[i];
+        if (dot(-p.n, s.center) - p.d > s.radius) {
+            CULL_STAT_SPHERE(1 << i, i + 1);
+            return 1;
+        }
+    }
+    CULL_STAT_SPHERE(0, 6);
+    return 0;
+}
+#endif
+
 void naive_cull(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frustum &f)
 {
+    TRACE_SCOPE("naive_cull");
     for (int i = 0, n = spheres.length; i < n; i++) {
         const Sphere &s = spheres.data[i];
+#if defined(SSECULLING_STATS)
+        const uint32_t result = naive_cull_sphere_stats(f, s);
+#else
         const uint32_t result = f.cull(s) & 1;
+#endif
         const int ri = i / 32;
         const int shift = i % 32;
         results.data[ri] |= result << shift;
@@ -71,64 +321,154 @@ void naive_cull(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frus
 
 void sse_cull(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frustum &f)
 {
+    TRACE_SCOPE("sse_cull");
     // we negate everything because we use this formula to cull:
     //   dot(-p.n, s.center) - p.d > s.radius
     // it's equivalent to:
     //   dot(p.n, s.center) + p.d < -s.radius
     // but no need to negate sphere radius
-    const __m128 plane_components[8] = {
-        simd_set(-f.planes[0].n.x, -f.planes[1].n.x, -f.planes[2].n.x, -f.planes[3].n.x),
-        simd_set(-f.planes[0].n.y, -f.planes[1].n.y, -f.planes[2].n.y, -f.planes[3].n.y),
-        simd_set(-f.planes[0].n.z, -f.planes[1].n.z, -f.planes[2].n.z, -f.planes[3].n.z),
-        simd_set(-f.planes[0].d,   -f.planes[1].d,   -f.planes[2].d,   -f.planes[3].d),
-        simd_set(-f.planes[4].n.x, -f.planes[5].n.x, -f.planes[4].n.x, -f.planes[5].n.x),
-        simd_set(-f.planes[4].n.y, -f.planes[5].n.y, -f.planes[4].n.y, -f.planes[5].n.y),
-        simd_set(-f.planes[4].n.z, -f.planes[5].n.z, -f.planes[4].n.z, -f.planes[5].n.z),
-        simd_set(-f.planes[4].d,   -f.planes[5].d,   -f.planes[4].d,   -f.planes[5].d),
-    };
+    __m128 plane_components[8];
+    simd_frustum_planes(plane_components, f);
 
     for (int i = 0, n = spheres.length; i < n; i++) {
-        // Load sphere into SSE register.
-        const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(spheres.data+i));
-        const __m128 xxxx = simd_splat_x(s);
-        const __m128 yyyy = simd_splat_y(s);
-        const __m128 zzzz = simd_splat_z(s);
-        const __m128 rrrr = simd_splat_w(s);
-
-        __m128 v, r;
-        // Move sphere center to plane normal space and make it relative to plane.
-        // dot(p.n, s) + p.d
-        v = simd_madd(xxxx, plane_components[0], plane_components[3]);
-        v = simd_madd(yyyy, plane_components[1], v);
-        v = simd_madd(zzzz, plane_components[2], v);
-
-        // One of r floats will be set to 0xFFFFFFFF if sphere is outside of the frustum.
-        r = _mm_cmpgt_ps(v, rrrr);
-
-        // Same for second set of planes.
-        v = simd_madd(xxxx, plane_components[4], plane_components[7]);
-        v = simd_madd(yyyy, plane_components[5], v);
-        v = simd_madd(zzzz, plane_components[6], v);
-
-        r = _mm_or_ps(r, _mm_cmpgt_ps(v, rrrr));
-
-        // Shuffle and extract the result:
-        // 1. movehl(r, r) does this (we're interested in 2 lower floats):
-        //    a b c d -> c d c d
-        // 2. then we OR it with the existing value (ignoring 2 upper floats)
-        //    a b | c d = A B
-        // 3. and then we OR it again ignoring all but 1 lowest float:
-        //    A | B = R
-        // Result is written in the lowest float.
-        r = _mm_or_ps(r, _mm_movehl_ps(r, r));
-        r = _mm_or_ps(r, simd_splat_y(r));
-
-        uint32_t result;
-        _mm_store_ss((float*)&result, r);
+        const uint32_t result = sse_cull_sphere(plane_components, spheres.data+i);
 
         // And write the result back to bit buffer.
         const int ri = i / 32;
         const int shift = i % 32;
-        results.data[ri] |= (result & 1) << shift;
+        results.data[ri] |= result << shift;
+    }
+}
+
+void sse_cull_masked(Slice<uint32_t> results, Slice<const Sphere> spheres, Slice<const uint32_t> layers,
+    uint32_t query, const Frustum &f)
+{
+    TRACE_SCOPE("sse_cull_masked");
+    NG_ASSERT(spheres.length == layers.length);
+    __m128 plane_components[8];
+    simd_frustum_planes(plane_components, f);
+    const __m128i q = _mm_set1_epi32(query);
+    const __m128i zero = _mm_setzero_si128();
+
+    // Results are built a word at a time. Layer masks of 4 spheres are tested
+    // with one AND and compare, so the filter costs a couple of instructions
+    // per 4 spheres on top of the frustum test.
+    const int n = spheres.length;
+    const int full_words = n / 32;
+    for (int w = 0; w < full_words; w++) {
+        uint32_t word = 0;
+        for (int b = 0; b < 32; b += 4) {
+            const int i = w * 32 + b;
+            const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers.data + i));
+            const int filtered = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(l, q), zero)));
+            word |= (uint32_t)filtered << b;
+            word |= sse_cull_sphere(plane_components, spheres.data + i + 0) << (b + 0);
+            word |= sse_cull_sphere(plane_components, spheres.data + i + 1) << (b + 1);
+            word |= sse_cull_sphere(plane_components, spheres.data + i + 2) << (b + 2);
+            word |= sse_cull_sphere(plane_components, spheres.data + i + 3) << (b + 3);
+        }
+        results.data[w] |= word;
+    }
+    for (int i = full_words * 32; i < n; i++) {
+        const uint32_t filtered = (layers.data[i] & query) == 0;
+        const uint32_t result = sse_cull_sphere(plane_components, spheres.data+i) | filtered;
+        results.data[i / 32] |= result << (i % 32);
+    }
+}
+
+FrustumSide sse_cull_box(const __m128 planes[8], const Vec3f &min, const Vec3f &max)
+{
+    // Same negated planes as in sse_cull, the box is represented as
+    // center + extent. The box is outside of a plane if:
+    //   dot(-p.n, center) - p.d > dot(abs(p.n), extent)
+    // and completely in front of it if:
+    //   dot(-p.n, center) - p.d <= -dot(abs(p.n), extent)
+    const __m128 bmin = simd_set(min.x, min.y, min.z, 0);
+    const __m128 bmax = simd_set(max.x, max.y, max.z, 0);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 c = _mm_mul_ps(_mm_add_ps(bmin, bmax), half);
+    const __m128 e = _mm_mul_ps(_mm_sub_ps(bmax, bmin), half);
+    const __m128 cx = simd_splat_x(c), cy = simd_splat_y(c), cz = simd_splat_z(c);
+    const __m128 ex = simd_splat_x(e), ey = simd_splat_y(e), ez = simd_splat_z(e);
+
+    __m128 v0, v1, r0, r1;
+    v0 = simd_madd(cx, planes[0], planes[3]);
+    v0 = simd_madd(cy, planes[1], v0);
+    v0 = simd_madd(cz, planes[2], v0);
+    r0 = _mm_mul_ps(ex, simd_abs(planes[0]));
+    r0 = simd_madd(ey, simd_abs(planes[1]), r0);
+    r0 = simd_madd(ez, simd_abs(planes[2]), r0);
+
+    v1 = simd_madd(cx, planes[4], planes[7]);
+    v1 = simd_madd(cy, planes[5], v1);
+    v1 = simd_madd(cz, planes[6], v1);
+    r1 = _mm_mul_ps(ex, simd_abs(planes[4]));
+    r1 = simd_madd(ey, simd_abs(planes[5]), r1);
+    r1 = simd_madd(ez, simd_abs(planes[6]), r1);
+
+    const __m128 outside = _mm_or_ps(_mm_cmpgt_ps(v0, r0), _mm_cmpgt_ps(v1, r1));
+    if (_mm_movemask_ps(outside) != 0)
+        return FS_OUTSIDE;
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 inside = _mm_and_ps(
+        _mm_cmple_ps(v0, _mm_sub_ps(zero, r0)),
+        _mm_cmple_ps(v1, _mm_sub_ps(zero, r1)));
+    if (_mm_movemask_ps(inside) == 0xF)
+        return FS_INSIDE;
+    return FS_BOTH;
+}
+
+void sse_sphere_bounds(Slice<const Sphere> spheres, Vec3f *min, Vec3f *max)
+{
+    NG_ASSERT(spheres.length > 0);
+    __m128 bmin = _mm_set1_ps(INFINITY);
+    __m128 bmax = _mm_set1_ps(-INFINITY);
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(spheres.data+i));
+        const __m128 rrrr = simd_splat_w(s);
+        bmin = _mm_min_ps(bmin, _mm_sub_ps(s, rrrr));
+        bmax = _mm_max_ps(bmax, _mm_add_ps(s, rrrr));
+    }
+
+    float tmp[4];
+    _mm_storeu_ps(tmp, bmin);
+    *min = Vec3f(tmp[0], tmp[1], tmp[2]);
+    _mm_storeu_ps(tmp, bmax);
+    *max = Vec3f(tmp[0], tmp[1], tmp[2]);
+}
+
+void sse_translate(Slice<Sphere> spheres, Slice<const Vec4f> deltas)
+{
+    NG_ASSERT(spheres.length == deltas.length);
+    // Zero out w, so that radius stays the same.
+    const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        float *s = reinterpret_cast<float*>(spheres.data+i);
+        const __m128 d = _mm_and_ps(_mm_loadu_ps(deltas.data[i].data), xyz_mask);
+        _mm_store_ps(s, _mm_add_ps(_mm_load_ps(s), d));
+    }
+}
+
+void sse_transform(Slice<Sphere> spheres, const Transform &tr)
+{
+    // Same as transform(const Vec3f&, const Transform&), but with rotation
+    // expanded into a 3x3 matrix. All columns have w set to 0, radius is
+    // copied from the source afterwards.
+    const Mat3 m = to_mat3(tr.orientation);
+    const __m128 col0 = simd_set(m.m11, m.m21, m.m31, 0);
+    const __m128 col1 = simd_set(m.m12, m.m22, m.m32, 0);
+    const __m128 col2 = simd_set(m.m13, m.m23, m.m33, 0);
+    const __m128 col3 = simd_set(tr.translation.x, tr.translation.y, tr.translation.z, 0);
+    const __m128 w_mask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        float *sp = reinterpret_cast<float*>(spheres.data+i);
+        const __m128 s = _mm_load_ps(sp);
+        __m128 v;
+        v = simd_madd(simd_splat_x(s), col0, col3);
+        v = simd_madd(simd_splat_y(s), col1, v);
+        v = simd_madd(simd_splat_z(s), col2, v);
+        v = _mm_or_ps(v, _mm_and_ps(s, w_mask));
+        _mm_store_ps(sp, v);
     }
 }
@@ -6,6 +6,9 @@
 #include "Core/Func.h"
 #include "Math/Sphere.h"
 #include "Math/Frustum.h"
+#include "Parallel.h"
+#include "Stats.h"
+#include "CullStats.h"
 
 enum DataType {
     Structured,
@@ -15,6 +18,52 @@ enum DataType {
 struct Config {
     int data_size = 80;
     bool verbose = false;
+    int threads = hardware_threads();
+    // Seed for all the random scene data.
+    uint32_t seed = 1;
+
+    // Override per-benchmark amounts of warmup and measured runs if set,
+    // fixed amount of runs disables adaptive stopping.
+    int warmup = -1;
+    int runs = -1;
+
+    // Recorded camera path for the camera path benchmarks, see CameraPath.cpp.
+    const char *camera_path = nullptr;
+
+    // Regular expression, only benchmarks with matching names are run.
+    const char *filter = nullptr;
+    // Print names of benchmarks instead of running them.
+    bool list = false;
+    // Run benchmarks over a range of scene sizes instead, see run_sweep().
+    bool sweep = false;
+
+    // measure() keeps running until the 95% confidence interval is within
+    // target_ci percent of the mean or until time_budget milliseconds pass.
+    double time_budget = 1000.0;
+    double target_ci = 1.0;
+
+    // Read bandwidth (GB/s) measured at startup, see Bandwidth.h. 0 if the
+    // probe was disabled with --no-bandwidth.
+    double bandwidth = 0;
+    bool bandwidth_probe = true;
+
+    // Background threads competing for memory bandwidth, see Antagonist.h.
+    int antagonist_streaming = 0;
+    int antagonist_chasing = 0;
+
+    // Record per-run latencies into a histogram and print its percentiles,
+    // on by default if there are antagonists.
+    bool histogram = false;
+
+    // Read hardware performance counters around measured runs, see Perf.h.
+    bool perf = false;
+
+    // Chrome trace output, needs SSECULLING_TRACE, see Trace.h.
+    const char *trace_path = nullptr;
+
+    // Optional machine-readable output, see Report.h.
+    const char *csv_path = nullptr;
+    const char *json_path = nullptr;
 };
 
 static inline int offset_3d(const Vec3i &p, const Vec3i &size)
@@ -22,6 +71,24 @@ static inline int offset_3d(const Vec3i &p, const Vec3i &size)
     return (p.z * size.y + p.y) * size.x + p.x;
 }
 
+// Spreads lower 10 bits of v so that there are two zero bits between each of
+// them.
+static inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// 30-bit Morton code, each coordinate should be in [0, 1024) range.
+static inline uint32_t morton_encode(const Vec3i &p)
+{
+    return morton_spread(p.x) | (morton_spread(p.y) << 1) | (morton_spread(p.z) << 2);
+}
+
 static inline __m128 simd_set(float x, float y, float z, float w)
 {
     return _mm_set_ps(w, z, y, x);
@@ -37,12 +104,113 @@ static inline __m128 simd_madd(__m128 a, __m128 b, __m128 c)
     return _mm_add_ps(_mm_mul_ps(a, b), c);
 }
 
+static inline __m128 simd_abs(__m128 v)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+// Loads frustum planes in a form suitable for SSE culling. Everything is
+// negated and packed as SoA: x, y, z, d of planes 0-3 and then the same for
+// planes 4-5 (duplicated to fill the register).
+static inline void simd_frustum_planes(__m128 out[8], const Frustum &f)
+{
+    out[0] = simd_set(-f.planes[0].n.x, -f.planes[1].n.x, -f.planes[2].n.x, -f.planes[3].n.x);
+    out[1] = simd_set(-f.planes[0].n.y, -f.planes[1].n.y, -f.planes[2].n.y, -f.planes[3].n.y);
+    out[2] = simd_set(-f.planes[0].n.z, -f.planes[1].n.z, -f.planes[2].n.z, -f.planes[3].n.z);
+    out[3] = simd_set(-f.planes[0].d,   -f.planes[1].d,   -f.planes[2].d,   -f.planes[3].d);
+    out[4] = simd_set(-f.planes[4].n.x, -f.planes[5].n.x, -f.planes[4].n.x, -f.planes[5].n.x);
+    out[5] = simd_set(-f.planes[4].n.y, -f.planes[5].n.y, -f.planes[4].n.y, -f.planes[5].n.y);
+    out[6] = simd_set(-f.planes[4].n.z, -f.planes[5].n.z, -f.planes[4].n.z, -f.planes[5].n.z);
+    out[7] = simd_set(-f.planes[4].d,   -f.planes[5].d,   -f.planes[4].d,   -f.planes[5].d);
+}
+
+// Returns 1 if the sphere is outside of the frustum, planes are loaded by
+// simd_frustum_planes.
+static inline uint32_t sse_cull_sphere(const __m128 planes[8], const Sphere *sphere)
+{
+    // Load sphere into SSE register.
+    const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(sphere));
+    const __m128 xxxx = simd_splat_x(s);
+    const __m128 yyyy = simd_splat_y(s);
+    const __m128 zzzz = simd_splat_z(s);
+    const __m128 rrrr = simd_splat_w(s);
+
+    __m128 v, r;
+    // Move sphere center to plane normal space and make it relative to plane.
+    // dot(p.n, s) + p.d
+    v = simd_madd(xxxx, planes[0], planes[3]);
+    v = simd_madd(yyyy, planes[1], v);
+    v = simd_madd(zzzz, planes[2], v);
+
+    // One of r floats will be set to 0xFFFFFFFF if sphere is outside of the frustum.
+    r = _mm_cmpgt_ps(v, rrrr);
+#if defined(SSECULLING_STATS)
+    const int planes_0_3 = _mm_movemask_ps(r);
+#endif
+
+    // Same for second set of planes.
+    v = simd_madd(xxxx, planes[4], planes[7]);
+    v = simd_madd(yyyy, planes[5], v);
+    v = simd_madd(zzzz, planes[6], v);
+
+    r = _mm_or_ps(r, _mm_cmpgt_ps(v, rrrr));
+#if defined(SSECULLING_STATS)
+    // 8 lanes are computed, but only 6 of them are distinct planes.
+    CULL_STAT_SPHERE(planes_0_3 | (_mm_movemask_ps(_mm_cmpgt_ps(v, rrrr)) & 3) << 4, 6);
+#endif
+
+    // Shuffle and extract the result:
+    // 1. movehl(r, r) does this (we're interested in 2 lower floats):
+    //    a b c d -> c d c d
+    // 2. then we OR it with the existing value (ignoring 2 upper floats)
+    //    a b | c d = A B
+    // 3. and then we OR it again ignoring all but 1 lowest float:
+    //    A | B = R
+    // Result is written in the lowest float.
+    r = _mm_or_ps(r, _mm_movehl_ps(r, r));
+    r = _mm_or_ps(r, simd_splat_y(r));
+
+    uint32_t result;
+    _mm_store_ss((float*)&result, r);
+    return result & 1;
+}
+
+// Sets bits [begin, end) to value.
+void fill_bits(Slice<uint32_t> bits, int begin, int end, bool value);
+
 void parse_args(Config *config, int argc, char **argv);
 void print_results(Slice<const uint32_t> bits, const Config &config);
-void measure(Func<void()> f, int warmup, int runs, const char *name, const Config &config);
+// Bytes read plus bytes written by a plain array kernel: every sphere is read
+// once and every result bit is written once.
+static inline double array_bytes(double objects)
+{
+    return objects * sizeof(Sphere) + (objects + 31) / 32 * sizeof(uint32_t);
+}
+
+// bytes_per_run is the memory traffic of one run of f, it's what GB/s and the
+// percentage of measured bandwidth are computed from. 0 means array_bytes()
+// of the scene, which is right for kernels over a flat array of spheres.
+Stats measure(Func<void()> f, int warmup, int runs, const char *name, const Config &config,
+    double bytes_per_run = 0);
 
 void naive_cull(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frustum &f);
 void sse_cull(Slice<uint32_t> results, Slice<const Sphere> spheres, const Frustum &f);
 
-void do_arrays(const Config &config);
-void do_chunks(const Config &config);
+// Same as sse_cull, but spheres which have none of the query bits set in their
+// layer mask are culled as well. layers runs parallel to spheres.
+void sse_cull_masked(Slice<uint32_t> results, Slice<const Sphere> spheres, Slice<const uint32_t> layers,
+    uint32_t query, const Frustum &f);
+
+// Tests an axis aligned box against planes loaded by simd_frustum_planes.
+// FS_OUTSIDE means everything inside the box is culled, FS_INSIDE means nothing
+// inside the box is culled.
+FrustumSide sse_cull_box(const __m128 planes[8], const Vec3f &min, const Vec3f &max);
+
+// Computes the box which contains all the spheres.
+void sse_sphere_bounds(Slice<const Sphere> spheres, Vec3f *min, Vec3f *max);
+
+// Moves sphere centers, radius is left untouched. The w component of deltas
+// is ignored.
+void sse_translate(Slice<Sphere> spheres, Slice<const Vec4f> deltas);
+void sse_transform(Slice<Sphere> spheres, const Transform &tr);
+
@@ -84,3 +84,4 @@ void AlignedAllocator::free_bytes(void *mem)
 }
 
 AlignedAllocator sse_allocator(16);
+AlignedAllocator cache_line_allocator(64);
@@ -88,3 +88,5 @@ struct AlignedAllocator : Allocator {
 
 // aligned to 16 bytes
 extern AlignedAllocator sse_allocator;
+// aligned to 64 bytes
+extern AlignedAllocator cache_line_allocator;
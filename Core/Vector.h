@@ -23,9 +23,53 @@ struct Vector {
 			reserve(_new_size(m_len + n));
 	}
 
+	// copy constructs n elements at uninitialized dst, trivially copyable
+	// types are copied with memcpy
+	template <typename It>
+	static void _construct_range(T *dst, It src, int n)
+	{
+		for (int i = 0; i < n; i++, ++src)
+			new (dst + i) T(*src);
+	}
+
+	static void _construct_range(T *dst, const T *src, int n)
+	{
+		if (std::is_trivially_copyable<T>::value) {
+			if (n > 0)
+				memcpy((void*)dst, (const void*)src, sizeof(T) * n);
+			return;
+		}
+		for (int i = 0; i < n; i++)
+			new (dst + i) T(src[i]);
+	}
+
+	static void _construct_range(T *dst, T *src, int n)
+	{
+		_construct_range(dst, (const T*)src, n);
+	}
+
+	// moves n elements from src to uninitialized dst and destroys the
+	// sources, the ranges must not overlap
+	static void _relocate(T *dst, T *src, int n)
+	{
+		if (std::is_trivially_copyable<T>::value) {
+			if (n > 0)
+				memcpy((void*)dst, (const void*)src, sizeof(T) * n);
+			return;
+		}
+		for (int i = 0; i < n; i++) {
+			new (dst + i) T(std::move(src[i]));
+			src[i].~T();
+		}
+	}
+
 	// expects: idx < _len, idx >= 0, offset > 0
 	void _move_forward(int idx, int offset)
 	{
+		if (std::is_trivially_copyable<T>::value) {
+			copy_memory(m_data + idx + offset, m_data + idx, m_len - idx);
+			return;
+		}
 		const int last = m_len-1;
 		int src = last;
 		int dst = last+offset;
@@ -40,6 +84,10 @@ struct Vector {
 	// expects: idx < _len, idx >= 0, offset < 0
 	void _move_backward(int idx, int offset)
 	{
+		if (std::is_trivially_copyable<T>::value) {
+			copy_memory(m_data + idx + offset, m_data + idx, m_len - idx);
+			return;
+		}
 		int src = idx;
 		int dst = idx+offset;
 		while (src < m_len) {
@@ -123,8 +171,7 @@ struct Vector {
 		if (m_len == 0)
 			return;
 		m_data = m_allocator->allocate_memory<T>(m_len);
-		for (int i = 0; i < m_len; i++)
-			new (m_data + i) T(s.data[i]);
+		_construct_range(m_data, s.data, m_len);
 	}
 
 	Vector(Slice<T> s): Vector(Slice<const T>(s))
@@ -139,10 +186,10 @@ struct Vector {
 	{
 	}
 
-	Vector(Vector &&r): m_data(r.m_data), m_len(r.m_len), m_cap(r.m_cap)
+	// a new vector simply takes over the allocator
+	Vector(Vector &&r): m_data(r.m_data), m_len(r.m_len), m_cap(r.m_cap),
+		m_allocator(r.m_allocator)
 	{
-		if (m_allocator != r.m_allocator)
-			die("Vector: moving is only allowed between vectors with the same allocator");
 		r._nullify();
 	}
 
@@ -237,10 +284,7 @@ struct Vector {
 		T *old_data = m_data;
 		m_cap = n;
 		m_data = m_allocator->allocate_memory<T>(m_cap);
-		for (int i = 0; i < m_len; i++) {
-			new (m_data + i) T(std::move(old_data[i]));
-			old_data[i].~T();
-		}
+		_relocate(m_data, old_data, m_len);
 		m_allocator->free_memory(old_data);
 	}
 
@@ -253,10 +297,7 @@ struct Vector {
 		m_cap = m_len;
 		if (m_len > 0) {
 			m_data = m_allocator->allocate_memory<T>(m_len);
-			for (int i = 0; i < m_len; i++) {
-				new (m_data + i) T(std::move(old_data[i]));
-				old_data[i].~T();
-			}
+			_relocate(m_data, old_data, m_len);
 		} else {
 			m_data = nullptr;
 		}
@@ -374,8 +415,7 @@ struct Vector {
 		_ensure_capacity(s.length);
 		if (idx < m_len)
 			_move_forward(idx, s.length);
-		for (int i = 0; i < s.length; i++)
-			new (m_data + idx + i) T(s.data[i]);
+		_construct_range(m_data + idx, s.data, s.length);
 		m_len += s.length;
 	}
 
@@ -409,6 +449,30 @@ struct Vector {
 		insert(m_len, s);
 	}
 
+	// appends n elements without constructing them, returns a pointer to the
+	// first one, the caller is expected to write all of them
+	T *append_uninitialized(int n)
+	{
+		static_assert(std::is_trivial<T>::value, "append_uninitialized requires a trivial type");
+		NG_ASSERT(n >= 0);
+		_ensure_capacity(n);
+		T *out = m_data + m_len;
+		m_len += n;
+		return out;
+	}
+
+	// appends [begin, end) with a single reallocation at most, the range
+	// must not point into the vector
+	template <typename It>
+	void append_range(It begin, It end)
+	{
+		const int n = end - begin;
+		NG_ASSERT(n >= 0);
+		_ensure_capacity(n);
+		_construct_range(m_data + m_len, begin, n);
+		m_len += n;
+	}
+
 	T &operator[](int idx)
 	{
 		NG_IDX_BOUNDS_CHECK(idx, m_len);
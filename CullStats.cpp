@@ -0,0 +1,55 @@
+#include "CullStats.h"
+#include <string.h>
+
+#if defined(SSECULLING_STATS)
+
+#include "Core/Vector.h"
+#include <mutex>
+
+// Counters are registered once per thread and never freed, worker threads
+// never exit anyway.
+static std::mutex stats_mutex;
+static Vector<CullStats*> thread_stats;
+static thread_local CullStats *local_stats = nullptr;
+
+CullStats &cull_stats()
+{
+    if (!local_stats) {
+        local_stats = new (OrDie) CullStats;
+        memset(local_stats, 0, sizeof(CullStats));
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        thread_stats.append(local_stats);
+    }
+    return *local_stats;
+}
+
+bool cull_stats_collect(CullStats *out)
+{
+    memset(out, 0, sizeof(CullStats));
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (CullStats *s : thread_stats) {
+        out->spheres_tested += s->spheres_tested;
+        out->plane_evaluations += s->plane_evaluations;
+        for (int i = 0; i < 6; i++)
+            out->early_outs[i] += s->early_outs[i];
+        out->chunks_accepted += s->chunks_accepted;
+        out->chunks_rejected += s->chunks_rejected;
+        out->chunks_tested += s->chunks_tested;
+        out->prefetches += s->prefetches;
+        out->frustum_rejections += s->frustum_rejections;
+        out->contribution_rejections += s->contribution_rejections;
+        out->distance_rejections += s->distance_rejections;
+        memset(s, 0, sizeof(CullStats));
+    }
+    return true;
+}
+
+#else
+
+bool cull_stats_collect(CullStats *out)
+{
+    memset(out, 0, sizeof(CullStats));
+    return false;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hot path counters, enabled with the SSECULLING_STATS cmake option. Without
+// it CULL_STAT and CULL_STAT_SPHERE expand to nothing and the kernels compile
+// to exactly the same code as if there were no counters at all.
+//
+// Every thread counts into its own CullStats, measure() aggregates them after
+// the measured runs and prints per frame averages.
+struct CullStats {
+    uint64_t spheres_tested;
+    uint64_t plane_evaluations;
+    // Culled spheres by index of the first plane which rejected them.
+    uint64_t early_outs[6];
+    // Chunks decided by their bounds alone (all visible or all culled) and
+    // chunks which had to be tested sphere by sphere.
+    uint64_t chunks_accepted;
+    uint64_t chunks_rejected;
+    uint64_t chunks_tested;
+    uint64_t prefetches;
+    // Spheres rejected by sse_cull_detail, each one is counted by the first
+    // test which rejected it.
+    uint64_t frustum_rejections;
+    uint64_t contribution_rejections;
+    uint64_t distance_rejections;
+};
+
+#if defined(SSECULLING_STATS)
+
+// Counters of the calling thread.
+CullStats &cull_stats();
+
+// Records a tested sphere, planes_mask has bit i set if plane i rejects it.
+static inline void cull_stats_sphere(int planes_mask, int plane_evaluations)
+{
+    CullStats &s = cull_stats();
+    s.spheres_tested++;
+    s.plane_evaluations += plane_evaluations;
+    for (int i = 0; i < 6; i++) {
+        if (planes_mask & (1 << i)) {
+            s.early_outs[i]++;
+            break;
+        }
+    }
+}
+
+#define CULL_STAT(field, n) (cull_stats().field += (n))
+#define CULL_STAT_SPHERE(planes_mask, plane_evaluations) cull_stats_sphere(planes_mask, plane_evaluations)
+
+#else
+
+#define CULL_STAT(field, n) ((void)0)
+#define CULL_STAT_SPHERE(planes_mask, plane_evaluations) ((void)0)
+
+#endif
+
+// Sums counters of all threads into out and resets them. Must be called when
+// no culling is running. Returns false if counters are compiled out.
+bool cull_stats_collect(CullStats *out);
@@ -0,0 +1,195 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "MemoryStats.h"
+#include "RadixSort.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+// Visible spheres sorted front to back for early-Z. Culling emits a 64-bit key
+// per visible sphere: view depth in upper 32 bits, sphere index in lower 32
+// bits. Depth is clamped to 0, and non-negative floats compare the same way
+// as their bit patterns, so the keys can be radix sorted as integers.
+//
+// Exact sort uses all 32 depth bits (4 passes). Approximate sort uses the
+// upper 16 bits only (2 passes): sign, exponent and 7 bits of mantissa, which
+// is about 1% relative depth precision. Spheres within one bucket stay in the
+// culling order.
+static const int depth_key_begin_bit = 32;
+static const int depth_key_approximate_begin_bit = 48;
+
+// Same as sse_cull, but also writes a key for every visible sphere to keys and
+// returns the amount of keys. keys must be at least as long as spheres, a key
+// is written for every sphere and only kept if the sphere is visible, so the
+// loop has no branches.
+static int sse_cull_depth_keys(Slice<uint32_t> results, Slice<uint64_t> keys, Slice<const Sphere> spheres,
+    const Frustum &f, float znear)
+{
+    TRACE_SCOPE("sse_cull_depth_keys");
+    NG_ASSERT(keys.length >= spheres.length);
+    static_assert(FP_NEAR == 1, "near plane distance is expected in lane 1");
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    const __m128 zn = _mm_set1_ps(znear);
+    const __m128 zero = _mm_setzero_ps();
+
+    int count = 0;
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(spheres.data + i));
+        const __m128 xxxx = simd_splat_x(s);
+        const __m128 yyyy = simd_splat_y(s);
+        const __m128 zzzz = simd_splat_z(s);
+        const __m128 rrrr = simd_splat_w(s);
+
+        __m128 v0, v1;
+        v0 = simd_madd(xxxx, planes[0], planes[3]);
+        v0 = simd_madd(yyyy, planes[1], v0);
+        v0 = simd_madd(zzzz, planes[2], v0);
+        v1 = simd_madd(xxxx, planes[4], planes[7]);
+        v1 = simd_madd(yyyy, planes[5], v1);
+        v1 = simd_madd(zzzz, planes[6], v1);
+        const uint32_t culled = _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(v0, rrrr), _mm_cmpgt_ps(v1, rrrr))) != 0;
+
+        const __m128 depth = _mm_max_ps(_mm_sub_ps(zn, simd_splat_y(v0)), zero);
+        uint32_t depth_bits;
+        _mm_store_ss(reinterpret_cast<float*>(&depth_bits), depth);
+        keys.data[count] = ((uint64_t)depth_bits << 32) | (uint32_t)i;
+        count += culled ^ 1;
+        results.data[i / 32] |= culled << (i % 32);
+    }
+    return count;
+}
+
+namespace {
+
+struct Data {
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    Vector<uint64_t> keys = Vector<uint64_t>(&key_memory);
+    Vector<uint64_t> tmp = Vector<uint64_t>(&key_memory);
+    int visible = 0;
+};
+
+}
+
+// Grid with jittered centers, this way spheres of one grid slice don't all
+// have the same depth.
+static Data generate_data(const Config &config)
+{
+    Data data;
+    const int half_size = config.data_size/2;
+    std::default_random_engine rng(config.seed);
+    std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+    Sphere *s = data.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
+        *s++ = Sphere(ToVec3f(p) + Vec3f(jitter(rng), jitter(rng), jitter(rng)), 1.0f);
+    }}}
+
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    data.keys.resize(data.spheres.length());
+    data.tmp.resize(data.spheres.length());
+    return data;
+}
+
+// Largest amount by which a sphere is in front of one sorted before it,
+// relative to the depth of that sphere. Always 0 for exact sorts.
+static double max_depth_error(Slice<const uint64_t> keys)
+{
+    double error = 0;
+    float front = 0;
+    for (int i = 0; i < keys.length; i++) {
+        const uint32_t bits = keys.data[i] >> 32;
+        float depth;
+        memcpy(&depth, &bits, sizeof(depth));
+        if (depth < front)
+            error = max(error, (double)(front - depth) / front);
+        front = max(front, depth);
+    }
+    return error;
+}
+
+enum DepthSortMode {
+    DepthCullOnly,
+    DepthKeysOnly,
+    DepthStdSort,
+    DepthRadixSort,
+    DepthApproximate,
+};
+
+// args: mode, threads (0 means config.threads)
+static Stats run_depth_sort(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const float znear = 0.5f;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, znear, 100.0f);
+    const DepthSortMode mode = (DepthSortMode)b.args[0];
+    const int threads = b.args[1] != 0 ? b.args[1] : config.threads;
+    Data data = generate_data(config);
+    auto cull = [&]{
+        fill<uint32_t>(data.results, 0);
+        data.visible = sse_cull_depth_keys(data.results, data.keys, data.spheres, f, znear);
+    };
+    // Culling writes 8 bytes per visible object on top of the usual traffic,
+    // every radix pass reads the keys twice (histogram and scatter) and writes
+    // them once. std::sort is counted as a single read and write of the keys,
+    // it's a lower bound. The visible count doesn't change between runs.
+    cull();
+    const double key_bytes = data.visible * sizeof(uint64_t);
+    const double cull_bytes = array_bytes(data.spheres.length()) + key_bytes;
+    const int exact_passes = (64 - depth_key_begin_bit) / 8;
+    const int approximate_passes = (64 - depth_key_approximate_begin_bit) / 8;
+    switch (mode) {
+    case DepthCullOnly:
+        stats = measure([&]{ fill<uint32_t>(data.results, 0); sse_cull(data.results, data.spheres, f); },
+            50, 10, b.name, config);
+        break;
+    case DepthKeysOnly:
+        stats = measure(cull, 50, 10, b.name, config, cull_bytes);
+        break;
+    case DepthStdSort:
+        stats = measure([&]{ cull(); sort(data.keys.sub(0, data.visible)); }, 50, 10, b.name, config,
+            cull_bytes + 2 * key_bytes);
+        break;
+    case DepthRadixSort:
+        stats = measure([&]{
+            cull();
+            radix_sort(data.keys.sub(0, data.visible), data.tmp, depth_key_begin_bit, 64, threads);
+        }, 50, 10, b.name, config, cull_bytes + exact_passes * 3 * key_bytes);
+        break;
+    case DepthApproximate:
+        stats = measure([&]{
+            cull();
+            radix_sort(data.keys.sub(0, data.visible), data.tmp, depth_key_approximate_begin_bit, 64, threads);
+        }, 50, 10, b.name, config, cull_bytes + approximate_passes * 3 * key_bytes);
+        break;
+    }
+    // Keys are only in depth order once they are sorted.
+    if (mode == DepthKeysOnly) {
+        printf("  visible: %d\n", data.visible);
+    } else if (mode != DepthCullOnly) {
+        printf("  visible: %d, max depth error: %.2f%%\n", data.visible,
+            max_depth_error(data.keys.sub(0, data.visible)) * 100.0);
+    }
+    print_results(data.results, config);
+    return stats;
+}
+
+void register_depth_sort(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_depth_sort, {DepthCullOnly}, "Depth sort / sse_cull");
+    add_benchmark(list, run_depth_sort, {DepthKeysOnly}, "Depth sort / cull + depth keys");
+    add_benchmark(list, run_depth_sort, {DepthStdSort}, "Depth sort / std::sort");
+    add_benchmark(list, run_depth_sort, {DepthRadixSort, 1}, "Depth sort / radix sort / 1 thread");
+    add_benchmark(list, run_depth_sort, {DepthRadixSort}, "Depth sort / radix sort / all threads");
+    add_benchmark(list, run_depth_sort, {DepthApproximate, 1}, "Depth sort / approximate / 1 thread");
+    add_benchmark(list, run_depth_sort, {DepthApproximate}, "Depth sort / approximate / all threads");
+}
@@ -0,0 +1,289 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <random>
+#include <algorithm>
+
+// All spheres live in one flat array, chunk i covers spheres
+// [i * chunk_size, (i+1) * chunk_size). Chunk size is a multiple of 32, this
+// way each chunk owns whole words of the results bitmap and culling a chunk
+// can simply overwrite them.
+namespace {
+
+struct Data {
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    int chunk_size = 0;
+
+    // Per-chunk bounds of all the spheres (including radius).
+    Vector<Vec3f> bounds_min = Vector<Vec3f>(&bounds_memory);
+    Vector<Vec3f> bounds_max = Vector<Vec3f>(&bounds_memory);
+
+    // Chunks with stale bounds, these are waiting for refit.
+    Vector<uint8_t> dirty = Vector<uint8_t>(&bounds_memory);
+    Vector<int> dirty_list = Vector<int>(&bounds_memory);
+
+    // Chunks refitted since the last cull, their results are stale.
+    Vector<int> changed_list = Vector<int>(&bounds_memory);
+
+    // Moving objects, ranges of spheres [x, y) and their deltas. Objects go
+    // back and forth, odd frames use deltas_back.
+    Vector<Vec2i> moving = Vector<Vec2i>(&motion_memory);
+    Vector<Vec4f> deltas = Vector<Vec4f>(&motion_memory);
+    Vector<Vec4f> deltas_back = Vector<Vec4f>(&motion_memory);
+    Transform transform;
+    Transform transform_back;
+    int frame = 0;
+};
+
+}
+
+static int num_chunks(const Data &data)
+{
+    return (data.spheres.length() + data.chunk_size - 1) / data.chunk_size;
+}
+
+static Slice<const Sphere> chunk_spheres(const Data &data, int chunk)
+{
+    const int begin = chunk * data.chunk_size;
+    const int end = std::min(begin + data.chunk_size, data.spheres.length());
+    return data.spheres.sub(begin, end);
+}
+
+static void mark_dirty(Data *data, int begin, int end)
+{
+    for (int c = begin / data->chunk_size, last = (end - 1) / data->chunk_size; c <= last; c++) {
+        if (data->dirty[c])
+            continue;
+        data->dirty[c] = 1;
+        data->dirty_list.append(c);
+    }
+}
+
+// Moves spheres [begin, begin + deltas.length) and marks their chunks as dirty.
+static void translate(Data *data, int begin, Slice<const Vec4f> deltas)
+{
+    if (deltas.length == 0)
+        return;
+    sse_translate(data->spheres.sub(begin, begin + deltas.length), deltas);
+    mark_dirty(data, begin, begin + deltas.length);
+}
+
+// Transforms spheres [begin, end) and marks their chunks as dirty.
+static void transform(Data *data, int begin, int end, const Transform &tr)
+{
+    if (begin == end)
+        return;
+    sse_transform(data->spheres.sub(begin, end), tr);
+    mark_dirty(data, begin, end);
+}
+
+static void refit_chunk(Data *data, int chunk)
+{
+    sse_sphere_bounds(chunk_spheres(*data, chunk),
+        &data->bounds_min[chunk], &data->bounds_max[chunk]);
+}
+
+// Refits bounds of dirty chunks only, the cost depends on the amount of
+// moving objects rather than the size of the scene.
+static void refit_dirty(Data *data)
+{
+    for (int c : data->dirty_list) {
+        refit_chunk(data, c);
+        data->dirty[c] = 0;
+        data->changed_list.append(c);
+    }
+    data->dirty_list.clear();
+}
+
+static void refit_all(Data *data)
+{
+    for (int c = 0, n = num_chunks(*data); c < n; c++)
+        refit_chunk(data, c);
+    for (int c : data->dirty_list) {
+        data->dirty[c] = 0;
+        data->changed_list.append(c);
+    }
+    data->dirty_list.clear();
+}
+
+static void cull_chunk(Data *data, const __m128 planes[8], int chunk, const Frustum &f)
+{
+    const int words_per_chunk = data->chunk_size / 32;
+    const int begin = chunk * words_per_chunk;
+    const int end = std::min(begin + words_per_chunk, data->results.length());
+    Slice<uint32_t> results = data->results.sub(begin, end);
+    switch (sse_cull_box(planes, data->bounds_min[chunk], data->bounds_max[chunk])) {
+    case FS_OUTSIDE:
+        CULL_STAT(chunks_rejected, 1);
+        fill<uint32_t>(results, 0xFFFFFFFF);
+        break;
+    case FS_INSIDE:
+        CULL_STAT(chunks_accepted, 1);
+        fill<uint32_t>(results, 0);
+        break;
+    case FS_BOTH:
+        CULL_STAT(chunks_tested, 1);
+        fill<uint32_t>(results, 0);
+        sse_cull(results, chunk_spheres(*data, chunk), f);
+        break;
+    }
+}
+
+static void cull_all(Data *data, const Frustum &f)
+{
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    for (int c = 0, n = num_chunks(*data); c < n; c++)
+        cull_chunk(data, planes, c, f);
+    data->changed_list.clear();
+}
+
+// If the frustum didn't change since the last cull, only the chunks which were
+// refitted need to be culled again.
+static void cull_changed(Data *data, const Frustum &f)
+{
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    for (int c : data->changed_list)
+        cull_chunk(data, planes, c, f);
+    data->changed_list.clear();
+}
+
+static void move_objects(Data *data, bool use_transform)
+{
+    const bool back = data->frame++ % 2 == 1;
+    if (use_transform) {
+        const Transform &tr = back ? data->transform_back : data->transform;
+        for (const Vec2i &r : data->moving)
+            transform(data, r.x, r.y, tr);
+        return;
+    }
+
+    const Vector<Vec4f> &deltas = back ? data->deltas_back : data->deltas;
+    int offset = 0;
+    for (const Vec2i &r : data->moving) {
+        const int len = r.y - r.x;
+        translate(data, r.x, deltas.sub(offset, offset + len));
+        offset += len;
+    }
+}
+
+static Data generate_data(const Config &config, int chunk_size, float moving_fraction)
+{
+    NG_ASSERT(chunk_size % 32 == 0);
+    Data data;
+    data.chunk_size = chunk_size;
+    const int half_size = config.data_size/2;
+    Sphere *s = data.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
+        *s++ = Sphere(ToVec3f(p), 1.0f);
+    }}}
+
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+
+    const int chunks = num_chunks(data);
+    data.bounds_min.resize(chunks);
+    data.bounds_max.resize(chunks);
+    data.dirty.resize(chunks);
+    fill<uint8_t>(data.dirty, 0);
+
+    // Moving objects come in runs of 32 spheres scattered across the scene.
+    std::default_random_engine rng(config.seed);
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+    Vector<int> runs;
+    for (int i = 0, n = data.spheres.length() / 32; i < n; i++)
+        runs.append(i * 32);
+    std::shuffle(runs.data(), runs.data() + runs.length(), rng);
+    runs.resize(std::max(1, (int)(runs.length() * moving_fraction)));
+    sort(runs.sub());
+    for (int begin : runs) {
+        data.moving.append(Vec2i(begin, begin + 32));
+        for (int i = 0; i < 32; i++) {
+            const Vec4f d(offset(rng), offset(rng), offset(rng), 0);
+            data.deltas.append(d);
+            data.deltas_back.append(Vec4f(-d.x, -d.y, -d.z, 0));
+        }
+    }
+
+    // Rotating around the origin moves far objects more, but for our scene
+    // size it stays within a unit or so.
+    const Quat q(Vec3f_Y(), 0.5f);
+    const Vec3f t(0.25f, 0, -0.25f);
+    data.transform = Transform(q, t);
+    data.transform_back = Transform(inverse(q), -inverse(q).rotate(t));
+
+    refit_all(&data);
+    return data;
+}
+
+// The baseline, moves objects and culls everything without using the bounds.
+static void flat_frame(Data *data, const Frustum &f)
+{
+    move_objects(data, false);
+    data->dirty_list.clear();
+    fill<uint32_t>(data->results, 0);
+    sse_cull(data->results, data->spheres, f);
+}
+
+enum DynamicMode {
+    FlatCull,
+    FullRefit,
+    DirtyRefit,
+    DirtyRefitTransforms,
+    DirtyRefitStaticCamera,
+};
+
+// args: chunk size, percent of moving objects, mode
+static Stats run_dynamic(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    Data data = generate_data(config, b.args[0], b.args[1] / 100.0f);
+    switch ((DynamicMode)b.args[2]) {
+    case FlatCull:
+        stats = measure([&]{ flat_frame(&data, f); }, 50, 10, b.name, config);
+        break;
+    case FullRefit:
+        stats = measure([&]{ move_objects(&data, false); refit_all(&data); cull_all(&data, f); }, 50, 10, b.name, config);
+        break;
+    case DirtyRefit:
+        stats = measure([&]{ move_objects(&data, false); refit_dirty(&data); cull_all(&data, f); }, 50, 10, b.name, config);
+        break;
+    case DirtyRefitTransforms:
+        stats = measure([&]{ move_objects(&data, true); refit_dirty(&data); cull_all(&data, f); }, 50, 10, b.name, config);
+        break;
+    case DirtyRefitStaticCamera:
+        cull_all(&data, f);
+        stats = measure([&]{ move_objects(&data, false); refit_dirty(&data); cull_changed(&data, f); }, 50, 10, b.name, config);
+        break;
+    }
+    print_results(data.results, config);
+    return stats;
+}
+
+void register_dynamic(BenchmarkList *list)
+{
+    const int chunk_size = 256;
+    const int percents[] = {1, 10, 100};
+    for (int percent : percents) {
+        begin_group(list);
+        add_benchmark(list, run_dynamic, {chunk_size, percent, FlatCull},
+            "Dynamic / %3d per chunk / %3d%% moving / flat sse_cull", chunk_size, percent);
+        add_benchmark(list, run_dynamic, {chunk_size, percent, FullRefit},
+            "Dynamic / %3d per chunk / %3d%% moving / full refit", chunk_size, percent);
+        add_benchmark(list, run_dynamic, {chunk_size, percent, DirtyRefit},
+            "Dynamic / %3d per chunk / %3d%% moving / dirty refit", chunk_size, percent);
+        add_benchmark(list, run_dynamic, {chunk_size, percent, DirtyRefitTransforms},
+            "Dynamic / %3d per chunk / %3d%% moving / dirty refit, transforms", chunk_size, percent);
+        add_benchmark(list, run_dynamic, {chunk_size, percent, DirtyRefitStaticCamera},
+            "Dynamic / %3d per chunk / %3d%% moving / dirty refit, static camera", chunk_size, percent);
+    }
+}
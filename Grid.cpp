@@ -0,0 +1,178 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <algorithm>
+#include <stdio.h>
+
+// Spheres placed on a regular grid, sphere (x, y, z) is stored at
+// offset_3d(Vec3i(x, y, z), size). Sphere positions are implicit, the array is
+// only used for the cells which can't be classified analytically.
+struct Grid {
+    Vec3f origin;
+    float spacing;
+    float radius;
+    Vec3i size;
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+};
+
+namespace {
+
+struct Data {
+    Grid grid;
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    int boundary_cells = 0;
+};
+
+}
+
+// Cells [lo, hi) of a row.
+struct Span {
+    int lo;
+    int hi;
+};
+
+static int clamp_cell(float x, int n)
+{
+    return (int)clamp(x, -2.0f, (float)(n + 2));
+}
+
+// Within a row sphere center is origin + x * spacing, which makes the distance
+// to each plane a linear function of x: a * x + b. Sphere is visible as long as
+// a * x + b >= -radius for all planes, this is an intersection of six half
+// lines. "sure" cells are at least one cell away from every plane boundary and
+// need no testing, cells in "maybe" but not in "sure" are tested one by one.
+static void classify_row(const Grid &g, const Frustum &f, int y, int z, Span *sure, Span *maybe)
+{
+    const int n = g.size.x;
+    const Vec3f row = g.origin + Vec3f(0, y * g.spacing, z * g.spacing);
+    *sure = {0, n};
+    *maybe = {0, n};
+    for (int i = 0; i < 6; i++) {
+        const Plane &p = f.planes[i];
+        const float a = p.n.x * g.spacing;
+        const float b = dot(p.n, row) + p.d;
+        if (std::abs(a) < 1e-6f) {
+            // Plane is parallel to the row, it's either all in or all out.
+            if (b < -g.radius - 1e-3f) {
+                *sure = *maybe = {0, 0};
+                return;
+            }
+            if (b < -g.radius + 1e-3f)
+                *sure = {0, 0};
+            continue;
+        }
+
+        const float t = (-g.radius - b) / a;
+        if (a > 0) {
+            // visible if x >= t
+            sure->lo = std::max(sure->lo, clamp_cell(std::ceil(t), n) + 1);
+            maybe->lo = std::max(maybe->lo, clamp_cell(std::floor(t), n) - 1);
+        } else {
+            // visible if x <= t
+            sure->hi = std::min(sure->hi, clamp_cell(std::floor(t), n));
+            maybe->hi = std::min(maybe->hi, clamp_cell(std::ceil(t), n) + 2);
+        }
+    }
+    maybe->lo = std::max(maybe->lo, 0);
+    maybe->hi = std::min(maybe->hi, n);
+    if (maybe->lo >= maybe->hi) {
+        *sure = *maybe = {0, 0};
+        return;
+    }
+    if (sure->lo >= sure->hi) {
+        // Nothing is guaranteed, test everything in maybe.
+        *sure = {maybe->lo, maybe->lo};
+        return;
+    }
+    sure->lo = std::max(sure->lo, maybe->lo);
+    sure->hi = std::min(sure->hi, maybe->hi);
+}
+
+static int cull_cells(Slice<uint32_t> results, const Grid &g, const __m128 planes[8], int begin, int end)
+{
+    for (int i = begin; i < end; i++) {
+        const uint32_t result = sse_cull_sphere(planes, g.spheres.data() + i);
+        results.data[i / 32] = (results.data[i / 32] & ~(1U << (i % 32))) | (result << (i % 32));
+    }
+    return end - begin;
+}
+
+// Results are overwritten, not ORed.
+static int grid_cull(Slice<uint32_t> results, const Grid &g, const Frustum &f)
+{
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+
+    int boundary = 0;
+    for (int z = 0; z < g.size.z; z++) {
+    for (int y = 0; y < g.size.y; y++) {
+        const int base = offset_3d(Vec3i(0, y, z), g.size);
+        Span sure, maybe;
+        classify_row(g, f, y, z, &sure, &maybe);
+        if (maybe.lo == maybe.hi) {
+            fill_bits(results, base, base + g.size.x, true);
+            continue;
+        }
+
+        fill_bits(results, base, base + maybe.lo, true);
+        boundary += cull_cells(results, g, planes, base + maybe.lo, base + sure.lo);
+        fill_bits(results, base + sure.lo, base + sure.hi, false);
+        boundary += cull_cells(results, g, planes, base + sure.hi, base + maybe.hi);
+        fill_bits(results, base + maybe.hi, base + g.size.x, true);
+    }}
+    return boundary;
+}
+
+static Data generate_data(const Config &config)
+{
+    Data data;
+    Grid &g = data.grid;
+    const int half_size = config.data_size/2;
+    g.size = Vec3i(config.data_size);
+    g.spacing = 2.0f;
+    g.radius = 1.0f;
+    g.origin = ToVec3f(Vec3i(-half_size) * Vec3i(2));
+    Sphere *s = g.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
+        *s++ = Sphere(ToVec3f(p), g.radius);
+    }}}
+
+    data.results.resize((g.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    return data;
+}
+
+// args: 1 to rasterize rows
+static Stats run_grid(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    Data data = generate_data(config);
+    if (b.args[0] == 0) {
+        stats = measure([&]{ fill<uint32_t>(data.results, 0); sse_cull(data.results, data.grid.spheres, f); },
+            50, 10, b.name, config);
+        print_results(data.results, config);
+        return stats;
+    }
+
+    stats = measure([&]{ data.boundary_cells = grid_cull(data.results, data.grid, f); },
+        50, 10, b.name, config);
+    print_results(data.results, config);
+    if (config.verbose) {
+        printf("boundary cells: %d of %d\n", data.boundary_cells, data.grid.spheres.length());
+    }
+    return stats;
+}
+
+void register_grid(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_grid, {0}, "Implicit grid / structured data / sse_cull");
+    add_benchmark(list, run_grid, {1}, "Implicit grid / structured data / rasterized rows");
+}
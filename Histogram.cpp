@@ -0,0 +1,81 @@
+#include "Histogram.h"
+#include "Math/Utils.h"
+#include <stdio.h>
+
+static const int sub_bucket_bits = 7;
+static const int sub_bucket_count = 1 << sub_bucket_bits;
+static const int sub_bucket_half = sub_bucket_count / 2;
+
+static int highest_bit(uint64_t v)
+{
+    int bit = 0;
+    while (v >>= 1)
+        bit++;
+    return bit;
+}
+
+static int bucket_index(uint64_t value)
+{
+    if (value < (uint64_t)sub_bucket_count)
+        return (int)value;
+    // value >> shift is in [sub_bucket_half, sub_bucket_count)
+    const int shift = highest_bit(value) - sub_bucket_bits + 1;
+    return sub_bucket_count + (shift - 1) * sub_bucket_half + (int)((value >> shift) - sub_bucket_half);
+}
+
+// Highest value which falls into the bucket.
+static uint64_t bucket_value(int index)
+{
+    if (index < sub_bucket_count)
+        return index;
+    const int shift = (index - sub_bucket_count) / sub_bucket_half + 1;
+    const uint64_t sub = (index - sub_bucket_count) % sub_bucket_half + sub_bucket_half;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *h, uint64_t value)
+{
+    const int index = bucket_index(value);
+    if (index >= h->counts.length()) {
+        const int old = h->counts.length();
+        h->counts.resize(index + 1);
+        for (int i = old; i <= index; i++)
+            h->counts[i] = 0;
+    }
+    h->counts[index]++;
+    if (h->total == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->total++;
+}
+
+uint64_t histogram_percentile(const Histogram &h, double p)
+{
+    if (h.total == 0)
+        return 0;
+    // Rank of the value, at least one so that p = 0 gives the min bucket.
+    uint64_t rank = (uint64_t)(p / 100.0 * h.total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < h.counts.length(); i++) {
+        seen += h.counts[i];
+        if (seen >= rank)
+            return min(bucket_value(i), h.max);
+    }
+    return h.max;
+}
+
+void print_histogram(const Histogram &h, double unit_scale, const char *unit)
+{
+    printf("    %14s %12s %10s\n", unit, "percentile", "count");
+    uint64_t seen = 0;
+    for (int i = 0; i < h.counts.length(); i++) {
+        if (h.counts[i] == 0)
+            continue;
+        seen += h.counts[i];
+        printf("    %14.6f %11.5f%% %10llu\n", min(bucket_value(i), h.max) / unit_scale,
+            seen * 100.0 / h.total, (unsigned long long)h.counts[i]);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Core/Vector.h"
+#include <stdint.h>
+
+// HDR-style histogram of integer values (nanoseconds in practice). Values below
+// 128 are counted exactly, above that every power of two range is split into
+// 64 linear buckets, so any recorded value is known within 1/64 (~1.6%) no
+// matter how large it is. Buckets are added as larger values are recorded, so
+// memory depends on the largest value rather than the amount of values (under
+// 32KB even for the full 64-bit range) and recording is amortized O(1), which
+// makes it suitable for long runs where the tail matters more than the average.
+struct Histogram {
+    Vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t min = 0;
+    uint64_t max = 0;
+};
+
+void histogram_record(Histogram *h, uint64_t value);
+
+// Smallest value v such that p percent of recorded values are <= v (within
+// bucket precision), p is in [0, 100].
+uint64_t histogram_percentile(const Histogram &h, double p);
+
+// Prints non-empty buckets with their cumulative percentiles, values are
+// divided by unit_scale (e.g. 1e6 to print nanoseconds as milliseconds).
+void print_histogram(const Histogram &h, double unit_scale, const char *unit);
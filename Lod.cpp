@@ -0,0 +1,335 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "MemoryStats.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <stdio.h>
+#include <math.h>
+#include <random>
+
+// LOD selection by projected size. Depth is the distance from the near plane
+// plus znear, which keeps working after the frustum was transformed to the
+// camera position. Projected radius in pixels is radius * projection_scale /
+// depth, LOD 0 is the most detailed one.
+static const int lod_thresholds = 4;
+
+struct LodParams {
+    float projection_scale;
+    float znear;
+    // Projected radius thresholds between LOD k and k + 1, descending.
+    float thresholds[lod_thresholds];
+    // Relative margin around the thresholds: an object switches to a coarser
+    // LOD once it's smaller than t * (1 - hysteresis) and back once it's
+    // bigger than t * (1 + hysteresis), so it doesn't flicker between two
+    // LODs when its size hovers around a threshold.
+    float hysteresis;
+    // Spheres with projected radius below min_size pixels or depth beyond
+    // max_distance are rejected by sse_cull_detail. 0 and INFINITY disable
+    // the tests.
+    float min_size;
+    float max_distance;
+};
+
+static LodParams lod_params(float fov, float znear, float viewport_height)
+{
+    LodParams p;
+    p.projection_scale = viewport_height / 2 / tanf(fov * MATH_DEG_TO_RAD / 2);
+    p.znear = znear;
+    p.thresholds[0] = 64.0f;
+    p.thresholds[1] = 32.0f;
+    p.thresholds[2] = 16.0f;
+    p.thresholds[3] = 8.0f;
+    p.hysteresis = 0.1f;
+    p.min_size = 0;
+    p.max_distance = INFINITY;
+    return p;
+}
+
+// The usual way: results of sse_cull are walked again and LODs are computed
+// for visible spheres only. LODs of culled spheres are left untouched.
+static void select_lods(Slice<uint8_t> lods, Slice<const uint32_t> results, Slice<const Sphere> spheres,
+    const Frustum &f, const LodParams &lp)
+{
+    TRACE_SCOPE("select_lods");
+    const Plane &near = f.planes[FP_NEAR];
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        if (results.data[i / 32] & (1U << (i % 32)))
+            continue;
+        const Sphere &s = spheres.data[i];
+        const float depth = max(dot(near.n, s.center) + near.d + lp.znear, lp.znear);
+        const float size = s.radius * lp.projection_scale / depth;
+        const int prev = lods.data[i];
+        int lod = 0;
+        for (int k = 0; k < lod_thresholds; k++)
+            lod += size < lp.thresholds[k] * (k < prev ? 1 + lp.hysteresis : 1 - lp.hysteresis);
+        lods.data[i] = lod;
+    }
+}
+
+// Frustum test, depth, projected size and LOD in one pass. Distance to the
+// near plane falls out of the plane tests (lane 1 of the first set, negated),
+// the four thresholds are compared at once and the LOD is the amount of
+// thresholds the sphere is smaller than. Culled spheres keep their LOD.
+static void sse_cull_lod(Slice<uint32_t> results, Slice<uint8_t> lods, Slice<const Sphere> spheres,
+    const Frustum &f, const LodParams &lp)
+{
+    TRACE_SCOPE("sse_cull_lod");
+    static const uint8_t bit_count[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+    static_assert(FP_NEAR == 1, "near plane distance is expected in lane 1");
+
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    const float *t = lp.thresholds;
+    const float down = 1 - lp.hysteresis;
+    const float up = 1 + lp.hysteresis;
+    const __m128 coarser = simd_set(t[0] * down, t[1] * down, t[2] * down, t[3] * down);
+    const __m128 finer = simd_set(t[0] * up, t[1] * up, t[2] * up, t[3] * up);
+    const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+    const __m128 scale = _mm_set1_ps(lp.projection_scale);
+    const __m128 znear = _mm_set1_ps(lp.znear);
+
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(spheres.data + i));
+        const __m128 xxxx = simd_splat_x(s);
+        const __m128 yyyy = simd_splat_y(s);
+        const __m128 zzzz = simd_splat_z(s);
+        const __m128 rrrr = simd_splat_w(s);
+
+        __m128 v0, v1;
+        v0 = simd_madd(xxxx, planes[0], planes[3]);
+        v0 = simd_madd(yyyy, planes[1], v0);
+        v0 = simd_madd(zzzz, planes[2], v0);
+        v1 = simd_madd(xxxx, planes[4], planes[7]);
+        v1 = simd_madd(yyyy, planes[5], v1);
+        v1 = simd_madd(zzzz, planes[6], v1);
+        const uint32_t culled = _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(v0, rrrr), _mm_cmpgt_ps(v1, rrrr))) != 0;
+
+        const __m128 depth = _mm_max_ps(_mm_sub_ps(znear, simd_splat_y(v0)), znear);
+        const __m128 size = _mm_div_ps(_mm_mul_ps(rrrr, scale), depth);
+        // Threshold k gets the upper margin if the sphere currently is on
+        // LOD k + 1 or coarser.
+        const uint8_t prev = lods.data[i];
+        const __m128 use_finer = _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(prev)));
+        const __m128 thresholds = _mm_or_ps(_mm_and_ps(use_finer, finer), _mm_andnot_ps(use_finer, coarser));
+        const uint8_t lod = bit_count[_mm_movemask_ps(_mm_cmplt_ps(size, thresholds))];
+
+        lods.data[i] = culled ? prev : lod;
+        results.data[i / 32] |= culled << (i % 32);
+    }
+}
+
+// Frustum, contribution and distance tests in one pass. A sphere is rejected
+// if it's outside of the frustum, if its projected radius is below
+// lp.min_size or if its depth is beyond its max distance: max_distances[i]
+// if the slice isn't empty, lp.max_distance otherwise. Contribution test
+// compares radius * scale < min_size * depth, so there is no division.
+static void sse_cull_detail(Slice<uint32_t> results, Slice<const Sphere> spheres, Slice<const float> max_distances,
+    const Frustum &f, const LodParams &lp)
+{
+    TRACE_SCOPE("sse_cull_detail");
+    NG_ASSERT(max_distances.length == 0 || max_distances.length == spheres.length);
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    const __m128 scale = _mm_set1_ps(lp.projection_scale);
+    const __m128 znear = _mm_set1_ps(lp.znear);
+    const __m128 min_size = _mm_set1_ps(lp.min_size);
+    const __m128 global_max_distance = _mm_set1_ps(lp.max_distance);
+    const bool per_object = max_distances.length > 0;
+
+    for (int i = 0, n = spheres.length; i < n; i++) {
+        const __m128 s = _mm_load_ps(reinterpret_cast<const float*>(spheres.data + i));
+        const __m128 xxxx = simd_splat_x(s);
+        const __m128 yyyy = simd_splat_y(s);
+        const __m128 zzzz = simd_splat_z(s);
+        const __m128 rrrr = simd_splat_w(s);
+
+        __m128 v0, v1;
+        v0 = simd_madd(xxxx, planes[0], planes[3]);
+        v0 = simd_madd(yyyy, planes[1], v0);
+        v0 = simd_madd(zzzz, planes[2], v0);
+        v1 = simd_madd(xxxx, planes[4], planes[7]);
+        v1 = simd_madd(yyyy, planes[5], v1);
+        v1 = simd_madd(zzzz, planes[6], v1);
+        const uint32_t frustum = _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(v0, rrrr), _mm_cmpgt_ps(v1, rrrr))) != 0;
+
+        // Depth is the same in all lanes, lane 0 is the contribution test
+        // and lane 1 the distance test.
+        const __m128 depth = _mm_sub_ps(znear, simd_splat_y(v0));
+        const __m128 max_distance = per_object ? _mm_load1_ps(max_distances.data + i) : global_max_distance;
+        const __m128 small = _mm_cmplt_ps(_mm_mul_ps(rrrr, scale), _mm_mul_ps(_mm_max_ps(depth, znear), min_size));
+        const __m128 far = _mm_cmpgt_ps(depth, max_distance);
+        const int detail = _mm_movemask_ps(_mm_unpacklo_ps(small, far)) & 3;
+
+#if defined(SSECULLING_STATS)
+        // Every rejected sphere is counted once, by the first test which
+        // rejected it.
+        CULL_STAT(spheres_tested, 1);
+        CULL_STAT(plane_evaluations, 6);
+        CULL_STAT(frustum_rejections, frustum);
+        CULL_STAT(contribution_rejections, !frustum && (detail & 1));
+        CULL_STAT(distance_rejections, !frustum && detail == 2);
+#endif
+        const uint32_t result = frustum | (detail != 0);
+        results.data[i / 32] |= result << (i % 32);
+    }
+}
+
+namespace {
+
+struct Data {
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    Vector<uint8_t> lods = Vector<uint8_t>(&lod_memory);
+    // Per-object max distances, only filled for DetailPerObjectDistance.
+    Vector<float> max_distances = Vector<float>(&distance_memory);
+    // The camera moves back and forth, odd frames use the second frustum.
+    Frustum frusta[2];
+    int frame = 0;
+};
+
+}
+
+static Data generate_data(const Config &config)
+{
+    Data data;
+    const int half_size = config.data_size/2;
+    Sphere *s = data.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
+        *s++ = Sphere(ToVec3f(p), 1.0f);
+    }}}
+
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    data.lods.resize(data.spheres.length());
+    fill<uint8_t>(data.lods, 0);
+
+    const Frustum base = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    data.frusta[0] = base;
+    data.frusta[1] = transform(base, Transform(Quat_Identity(), Vec3f(0, 0, 1.5f)));
+    return data;
+}
+
+// Spheres of varying size for detail culling, radii are uniform in
+// [0.02, 1]. Which of them fall under min_size depends on their depth: at
+// 1080p and 75 degrees, 1 pixel is a radius of about 0.14 at the far plane,
+// so around 12% of the spheres there and fewer closer to the camera.
+// With per-object distances every sphere belongs to one of four classes with
+// its own draw distance.
+static Data generate_detail_data(const Config &config, bool per_object_distances)
+{
+    Data data = generate_data(config);
+    std::default_random_engine rng(config.seed);
+    std::uniform_real_distribution<float> radius(0.02f, 1.0f);
+    for (Sphere &s : data.spheres)
+        s.radius = radius(rng);
+    if (per_object_distances) {
+        const float class_distances[4] = {25.0f, 50.0f, 75.0f, 100.0f};
+        float *d = data.max_distances.append_uninitialized(data.spheres.length());
+        for (int i = 0, n = data.spheres.length(); i < n; i++)
+            d[i] = class_distances[i % 4];
+    }
+    return data;
+}
+
+static void print_lods(const Data &data)
+{
+    int counts[lod_thresholds + 1] = {};
+    int visible = 0;
+    for (int i = 0, n = data.spheres.length(); i < n; i++) {
+        if (data.results[i / 32] & (1U << (i % 32)))
+            continue;
+        counts[data.lods[i]]++;
+        visible++;
+    }
+    printf("  visible by LOD:");
+    for (int i = 0; i <= lod_thresholds; i++)
+        printf(" %.1f%%", visible > 0 ? counts[i] * 100.0 / visible : 0.0);
+    printf("\n");
+}
+
+// args: 1 to use the fused kernel
+static Stats run_lod(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const LodParams lp = lod_params(75.0f, 0.5f, 1080.0f);
+    Data data = generate_data(config);
+    auto frame = [&]{
+        const Frustum &f = data.frusta[data.frame++ % 2];
+        fill<uint32_t>(data.results, 0);
+        if (b.args[0] == 0) {
+            sse_cull(data.results, data.spheres, f);
+            select_lods(data.lods, data.results, data.spheres, f, lp);
+        } else {
+            sse_cull_lod(data.results, data.lods, data.spheres, f, lp);
+        }
+    };
+    // LODs are read and written once per object. The second pass walks the
+    // results, spheres and LODs again, all of it is counted even though only
+    // visible spheres are loaded.
+    const int n = data.spheres.length();
+    const double fused_bytes = array_bytes(n) + 2.0 * n;
+    stats = measure(frame, 50, 10, b.name, config, b.args[0] == 0 ? fused_bytes + array_bytes(n) : fused_bytes);
+    // End on the base frustum, the output shouldn't depend on the amount of
+    // runs.
+    if (data.frame % 2 == 1)
+        frame();
+    print_lods(data);
+    print_results(data.results, config);
+    return stats;
+}
+
+enum DetailMode {
+    DetailFrustumOnly,
+    DetailMinSize,
+    DetailGlobalDistance,
+    DetailPerObjectDistance,
+    DetailAll,
+};
+
+// args: mode
+static Stats run_detail(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    const DetailMode mode = (DetailMode)b.args[0];
+    LodParams lp = lod_params(75.0f, 0.5f, 1080.0f);
+    if (mode == DetailMinSize || mode == DetailAll)
+        lp.min_size = 1.0f;
+    if (mode == DetailGlobalDistance)
+        lp.max_distance = 60.0f;
+    Data data = generate_detail_data(config, mode == DetailPerObjectDistance || mode == DetailAll);
+    if (mode == DetailFrustumOnly) {
+        stats = measure([&]{ fill<uint32_t>(data.results, 0); sse_cull(data.results, data.spheres, f); },
+            50, 10, b.name, config);
+    } else {
+        stats = measure([&]{
+            fill<uint32_t>(data.results, 0);
+            sse_cull_detail(data.results, data.spheres, data.max_distances, f, lp);
+        }, 50, 10, b.name, config, array_bytes(data.spheres.length()) + data.max_distances.length() * sizeof(float));
+    }
+    int culled = 0;
+    for (uint32_t word : data.results)
+        culled += __builtin_popcount(word);
+    printf("  visible: %.1f%%\n", (data.spheres.length() - culled) * 100.0 / data.spheres.length());
+    print_results(data.results, config);
+    return stats;
+}
+
+void register_lod(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_lod, {0}, "LOD selection / sse_cull + second pass");
+    add_benchmark(list, run_lod, {1}, "LOD selection / fused");
+
+    begin_group(list);
+    add_benchmark(list, run_detail, {DetailFrustumOnly}, "Detail culling / sse_cull");
+    add_benchmark(list, run_detail, {DetailMinSize}, "Detail culling / min size 1px");
+    add_benchmark(list, run_detail, {DetailGlobalDistance}, "Detail culling / global max distance");
+    add_benchmark(list, run_detail, {DetailPerObjectDistance}, "Detail culling / per-object max distance");
+    add_benchmark(list, run_detail, {DetailAll}, "Detail culling / min size 1px + per-object distance");
+}
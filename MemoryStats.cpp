@@ -0,0 +1,99 @@
+#include "MemoryStats.h"
+#include "Core/Utils.h"
+#include "Math/Utils.h"
+
+static MemoryTagStats tag_stats[MT_COUNT];
+// All tags together, the sum of per-tag peaks overstates the real peak when
+// tags peak at different times.
+static int64_t total_live_bytes = 0;
+static int64_t total_peak_bytes = 0;
+
+static const char *tag_names[MT_COUNT] = {
+    "spheres",
+    "results",
+    "chunk headers",
+    "mappings",
+    "inline chunks",
+    "layers",
+    "max distances",
+    "nodes",
+    "bounds",
+    "keys",
+    "motion",
+    "LODs",
+};
+
+TrackingAllocator::TrackingAllocator(Allocator *parent, int align, MemoryTag tag):
+    parent(parent), align(align), tag(tag)
+{
+    NG_ASSERT(align >= (int)sizeof(int64_t));
+}
+
+void *TrackingAllocator::allocate_bytes(int n)
+{
+    char *mem = (char*)parent->allocate_bytes(align + n);
+    *(int64_t*)mem = n;
+    MemoryTagStats &s = tag_stats[tag];
+    s.live_bytes += n;
+    s.peak_bytes = max(s.peak_bytes, s.live_bytes);
+    s.allocations++;
+    total_live_bytes += n;
+    total_peak_bytes = max(total_peak_bytes, total_live_bytes);
+    s.alignment_waste += (align - n % align) % align;
+    return mem + align;
+}
+
+void TrackingAllocator::free_bytes(void *mem)
+{
+    char *block = (char*)mem - align;
+    const int64_t n = *(int64_t*)block;
+    MemoryTagStats &s = tag_stats[tag];
+    s.live_bytes -= n;
+    s.frees++;
+    total_live_bytes -= n;
+    s.alignment_waste -= (align - n % align) % align;
+    parent->free_bytes(block);
+}
+
+TrackingAllocator sphere_memory(&sse_allocator, 16, MT_SPHERES);
+TrackingAllocator result_memory(&default_allocator, 16, MT_RESULTS);
+TrackingAllocator chunk_header_memory(&default_allocator, 16, MT_CHUNK_HEADERS);
+TrackingAllocator mapping_memory(&default_allocator, 16, MT_MAPPINGS);
+TrackingAllocator inline_chunk_memory(&cache_line_allocator, 64, MT_INLINE_CHUNKS);
+TrackingAllocator layer_memory(&default_allocator, 16, MT_LAYERS);
+TrackingAllocator distance_memory(&default_allocator, 16, MT_DISTANCES);
+TrackingAllocator node_memory(&default_allocator, 16, MT_NODES);
+TrackingAllocator bounds_memory(&default_allocator, 16, MT_BOUNDS);
+TrackingAllocator key_memory(&default_allocator, 16, MT_KEYS);
+TrackingAllocator motion_memory(&default_allocator, 16, MT_MOTION);
+TrackingAllocator lod_memory(&default_allocator, 16, MT_LODS);
+
+const char *memory_tag_name(MemoryTag tag)
+{
+    return tag_names[tag];
+}
+
+const MemoryTagStats &memory_stats(MemoryTag tag)
+{
+    return tag_stats[tag];
+}
+
+void memory_stats_reset()
+{
+    for (MemoryTagStats &s : tag_stats) {
+        s.peak_bytes = s.live_bytes;
+        s.allocations = 0;
+        s.frees = 0;
+    }
+    total_peak_bytes = total_live_bytes;
+}
+
+int64_t memory_live_bytes()
+{
+    return total_live_bytes;
+}
+
+int64_t memory_peak_bytes()
+{
+    return total_peak_bytes;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Core/Memory.h"
+#include <stdint.h>
+
+// What a block of memory is used for. Every tag has its own TrackingAllocator,
+// a Vector or an object allocated with it shows up in the tag's counters.
+enum MemoryTag {
+    MT_SPHERES,
+    MT_RESULTS,
+    MT_CHUNK_HEADERS,
+    MT_MAPPINGS,
+    // Header, spheres and results in one block, see InlineChunk in Chunks.cpp.
+    MT_INLINE_CHUNKS,
+    // Per-object layer masks, see run_layers in Arrays.cpp.
+    MT_LAYERS,
+    // Per-object max distances, see sse_cull_detail in Lod.cpp.
+    MT_DISTANCES,
+    // Octree nodes and their object lists, see Octree.cpp.
+    MT_NODES,
+    // Per-chunk bounds and their dirty state, see Dynamic.cpp.
+    MT_BOUNDS,
+    // Sort keys, see MortonOrder in Reorder.cpp and DepthSort.cpp.
+    MT_KEYS,
+    // Moving objects and their per-frame deltas.
+    MT_MOTION,
+    // Per-object LOD selection, see sse_cull_lod in Lod.cpp.
+    MT_LODS,
+    MT_COUNT,
+};
+
+struct MemoryTagStats {
+    // Requested bytes, instrumentation headers are not included.
+    int64_t live_bytes;
+    int64_t peak_bytes;
+    int64_t allocations;
+    int64_t frees;
+    // Live bytes lost to rounding requests up to the allocator alignment.
+    int64_t alignment_waste;
+};
+
+// Wraps another allocator and counts what goes through it. Every block gets a
+// header of `align` bytes in front of it with the requested size, this way
+// the returned pointer keeps the parent's alignment. Counters are not atomic,
+// tagged memory is expected to be allocated on the main thread.
+struct TrackingAllocator : Allocator {
+    Allocator *parent;
+    int align;
+    MemoryTag tag;
+
+    TrackingAllocator(Allocator *parent, int align, MemoryTag tag);
+    void *allocate_bytes(int n) override;
+    void free_bytes(void *mem) override;
+};
+
+// Spheres are 16 byte aligned for SSE loads, the rest is malloc aligned.
+extern TrackingAllocator sphere_memory;
+extern TrackingAllocator result_memory;
+extern TrackingAllocator chunk_header_memory;
+extern TrackingAllocator mapping_memory;
+// Cache line aligned.
+extern TrackingAllocator inline_chunk_memory;
+extern TrackingAllocator layer_memory;
+extern TrackingAllocator distance_memory;
+extern TrackingAllocator node_memory;
+extern TrackingAllocator bounds_memory;
+extern TrackingAllocator key_memory;
+extern TrackingAllocator motion_memory;
+extern TrackingAllocator lod_memory;
+
+const char *memory_tag_name(MemoryTag tag);
+const MemoryTagStats &memory_stats(MemoryTag tag);
+
+// Resets allocation counts and makes peaks equal to live bytes, called before
+// every benchmark so that peaks include building the scene.
+void memory_stats_reset();
+
+// Live bytes of all tags together and their peak since memory_stats_reset().
+int64_t memory_live_bytes();
+int64_t memory_peak_bytes();
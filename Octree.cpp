@@ -0,0 +1,315 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <random>
+#include <algorithm>
+
+// Loose octree, node bounds are twice as big as the cell the node occupies.
+// Objects are placed by center into the deepest cell which is at least as big
+// as their radius, this way an object always fits into the loose bounds of its
+// node and keeps fitting there until its center leaves the cell by more than
+// half of the cell size. Moving an object within these limits is O(1).
+// Objects which don't fit into the loose bounds of the root are kept in an
+// overflow list which is tested on every cull.
+struct Node {
+    Vec3f center;
+    float half_size;
+    int parent = -1;
+    // Children are allocated 8 at a time, -1 if there are none.
+    int first_child = -1;
+    // Amount of objects in this node and all of its children.
+    int subtree_count = 0;
+    Vector<int> objects = Vector<int>(&node_memory);
+};
+
+struct Octree {
+    Vector<Node> nodes = Vector<Node>(&node_memory);
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    // Node and index within Node::objects for each object. Node is -1 for
+    // objects in overflow, slot is their index there.
+    Vector<int> object_node = Vector<int>(&mapping_memory);
+    Vector<int> object_slot = Vector<int>(&mapping_memory);
+    Vector<int> overflow = Vector<int>(&mapping_memory);
+    int max_depth = 0;
+    int reinserts = 0;
+};
+
+static bool fits_loose_bounds(const Node &n, const Sphere &s)
+{
+    const Vec3f d = abs(s.center - n.center) + Vec3f(s.radius);
+    const float loose = n.half_size * 2.0f;
+    return d.x <= loose && d.y <= loose && d.z <= loose;
+}
+
+static bool inside_cell(const Node &n, const Vec3f &p)
+{
+    const Vec3f d = abs(p - n.center);
+    return d.x <= n.half_size && d.y <= n.half_size && d.z <= n.half_size;
+}
+
+static int child_index(const Node &n, const Vec3f &p)
+{
+    return (p.x >= n.center.x ? 1 : 0) | (p.y >= n.center.y ? 2 : 0) | (p.z >= n.center.z ? 4 : 0);
+}
+
+static void split(Octree *o, int node)
+{
+    const int first = o->nodes.length();
+    const Vec3f center = o->nodes[node].center;
+    const float half = o->nodes[node].half_size / 2;
+    for (int i = 0; i < 8; i++) {
+        Node *n = o->nodes.append();
+        n->center = center + Vec3f(i & 1 ? half : -half, i & 2 ? half : -half, i & 4 ? half : -half);
+        n->half_size = half;
+        n->parent = node;
+    }
+    o->nodes[node].first_child = first;
+}
+
+static void insert(Octree *o, int id)
+{
+    const Sphere &s = o->spheres[id];
+    if (!fits_loose_bounds(o->nodes[0], s)) {
+        o->object_node[id] = -1;
+        o->object_slot[id] = o->overflow.length();
+        o->overflow.append(id);
+        return;
+    }
+
+    int node = 0;
+    for (int depth = 0; depth < o->max_depth; depth++) {
+        const Node &n = o->nodes[node];
+        // Stop if the object doesn't fit into loose bounds of children. Center
+        // outside of the root cell is fine as long as the object fits into
+        // loose bounds of the root, it simply stays there.
+        if (s.radius > n.half_size / 2 || !inside_cell(n, s.center))
+            break;
+        if (n.first_child == -1)
+            split(o, node);
+        node = o->nodes[node].first_child + child_index(o->nodes[node], s.center);
+    }
+
+    Node &n = o->nodes[node];
+    o->object_node[id] = node;
+    o->object_slot[id] = n.objects.length();
+    n.objects.append(id);
+    for (int i = node; i != -1; i = o->nodes[i].parent)
+        o->nodes[i].subtree_count++;
+}
+
+static void remove(Octree *o, int id)
+{
+    const int node = o->object_node[id];
+    const int slot = o->object_slot[id];
+    if (node == -1) {
+        o->overflow.quick_remove(slot);
+        if (slot < o->overflow.length())
+            o->object_slot[o->overflow[slot]] = slot;
+        return;
+    }
+    Node &n = o->nodes[node];
+    n.objects.quick_remove(slot);
+    if (slot < n.objects.length())
+        o->object_slot[n.objects[slot]] = slot;
+    for (int i = node; i != -1; i = o->nodes[i].parent)
+        o->nodes[i].subtree_count--;
+}
+
+static void move(Octree *o, int id, const Vec3f &center)
+{
+    o->spheres[id].center = center;
+    const int node = o->object_node[id];
+    // Objects stay in their node while they fit and in overflow until they fit
+    // into the root again.
+    const bool in_overflow = node == -1;
+    if (fits_loose_bounds(o->nodes[in_overflow ? 0 : node], o->spheres[id]) != in_overflow)
+        return;
+    remove(o, id);
+    insert(o, id);
+    o->reinserts++;
+}
+
+static void clear_bit(Slice<uint32_t> results, int i)
+{
+    results.data[i / 32] &= ~(1U << (i % 32));
+}
+
+static void accept_subtree(const Octree &o, Slice<uint32_t> results, int node)
+{
+    const Node &n = o.nodes[node];
+    for (int id : n.objects)
+        clear_bit(results, id);
+    if (n.first_child == -1)
+        return;
+    for (int i = 0; i < 8; i++) {
+        if (o.nodes[n.first_child + i].subtree_count != 0)
+            accept_subtree(o, results, n.first_child + i);
+    }
+}
+
+static void cull_node(const Octree &o, Slice<uint32_t> results, const __m128 planes[8], int node)
+{
+    const Node &n = o.nodes[node];
+    const Vec3f loose(n.half_size * 2.0f);
+    switch (sse_cull_box(planes, n.center - loose, n.center + loose)) {
+    case FS_OUTSIDE:
+        return;
+    case FS_INSIDE:
+        accept_subtree(o, results, node);
+        return;
+    case FS_BOTH:
+        break;
+    }
+
+    for (int id : n.objects) {
+        if (!sse_cull_sphere(planes, o.spheres.data() + id))
+            clear_bit(results, id);
+    }
+    if (n.first_child == -1)
+        return;
+    for (int i = 0; i < 8; i++) {
+        if (o.nodes[n.first_child + i].subtree_count != 0)
+            cull_node(o, results, planes, n.first_child + i);
+    }
+}
+
+// Everything is culled by default, only visible objects touch the results.
+static void octree_cull(Slice<uint32_t> results, const Octree &o, const Frustum &f)
+{
+    __m128 planes[8];
+    simd_frustum_planes(planes, f);
+    fill<uint32_t>(results, 0xFFFFFFFF);
+    cull_node(o, results, planes, 0);
+    for (int id : o.overflow) {
+        if (!sse_cull_sphere(planes, o.spheres.data() + id))
+            clear_bit(results, id);
+    }
+}
+
+namespace {
+
+struct Data {
+    Octree octree;
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+
+    // Moving objects go back and forth, odd frames use deltas_back.
+    Vector<int> moving = Vector<int>(&motion_memory);
+    Vector<Vec3f> deltas = Vector<Vec3f>(&motion_memory);
+    Vector<Vec3f> deltas_back = Vector<Vec3f>(&motion_memory);
+    int frame = 0;
+};
+
+}
+
+static Data generate_data(const Config &config, int spacing, float moving_fraction)
+{
+    Data data;
+    const int half_size = config.data_size/2;
+    Sphere *s = data.spheres.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(spacing);
+        *s++ = Sphere(ToVec3f(p), 1.0f);
+    }}}
+
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+
+    // Pick a depth which leaves around 16 objects per leaf, but don't go below
+    // the object size.
+    Octree &o = data.octree;
+    const float extent = (half_size + 1) * spacing;
+    o.max_depth = 0;
+    while ((1 << (3 * (o.max_depth + 1))) * 16 <= data.spheres.length() &&
+            extent / (1 << (o.max_depth + 1)) >= 1.0f)
+        o.max_depth++;
+    Node *root = o.nodes.append();
+    root->center = Vec3f(0);
+    root->half_size = extent;
+
+    o.spheres = data.spheres;
+    o.object_node.resize(data.spheres.length());
+    o.object_slot.resize(data.spheres.length());
+    for (int i = 0; i < data.spheres.length(); i++)
+        insert(&o, i);
+
+    // Moving objects are randomly picked, they move in random directions
+    // within a spacing-sized box, which sometimes crosses the loose bounds.
+    const int moving_count = data.spheres.length() * moving_fraction;
+    std::default_random_engine rng(config.seed);
+    std::uniform_real_distribution<float> offset(-0.5f * spacing, 0.5f * spacing);
+    Vector<int> ids;
+    int *id = ids.append_uninitialized(data.spheres.length());
+    for (int i = 0; i < data.spheres.length(); i++)
+        id[i] = i;
+    std::shuffle(ids.data(), ids.data() + ids.length(), rng);
+    data.moving.append_range(ids.data(), ids.data() + moving_count);
+    for (int i = 0; i < moving_count; i++) {
+        const Vec3f d(offset(rng), offset(rng), offset(rng));
+        data.deltas.append(d);
+        data.deltas_back.append(-d);
+    }
+    return data;
+}
+
+static void flat_frame(Data *data, const Frustum &f)
+{
+    const Vector<Vec3f> &deltas = data->frame++ % 2 == 1 ? data->deltas_back : data->deltas;
+    for (int i = 0, n = data->moving.length(); i < n; i++)
+        data->spheres[data->moving[i]].center += deltas[i];
+    fill<uint32_t>(data->results, 0);
+    sse_cull(data->results, data->spheres, f);
+}
+
+static void octree_frame(Data *data, const Frustum &f)
+{
+    const Vector<Vec3f> &deltas = data->frame++ % 2 == 1 ? data->deltas_back : data->deltas;
+    Octree *o = &data->octree;
+    for (int i = 0, n = data->moving.length(); i < n; i++) {
+        const int id = data->moving[i];
+        move(o, id, o->spheres[id].center + deltas[i]);
+    }
+    octree_cull(data->results, *o, f);
+}
+
+// args: spacing, percent of moving objects, 1 to use the octree
+static Stats run_octree(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    Data data = generate_data(config, b.args[0], b.args[1] / 100.0f);
+    if (b.args[2] == 0) {
+        stats = measure([&]{ flat_frame(&data, f); }, 50, 10, b.name, config);
+        print_results(data.results, config);
+        return stats;
+    }
+
+    stats = measure([&]{ octree_frame(&data, f); }, 50, 10, b.name, config);
+    print_results(data.results, config);
+    if (config.verbose) {
+        printf("nodes: %d, max depth: %d, reinserts: %d, overflow: %d\n",
+            data.octree.nodes.length(), data.octree.max_depth, data.octree.reinserts,
+            data.octree.overflow.length());
+    }
+    return stats;
+}
+
+void register_octree(BenchmarkList *list)
+{
+    const int spacings[] = {2, 4, 8};
+    const int percents[] = {0, 10, 100};
+    for (int spacing : spacings) {
+        begin_group(list);
+        for (int percent : percents) {
+            add_benchmark(list, run_octree, {spacing, percent, 0},
+                "Loose octree / spacing %d / %3d%% moving / flat sse_cull", spacing, percent);
+            add_benchmark(list, run_octree, {spacing, percent, 1},
+                "Loose octree / spacing %d / %3d%% moving / octree", spacing, percent);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#include "Parallel.h"
+#include "Trace.h"
+#include "Core/Memory.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct Pool {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    // Worker i runs thread index i, index 0 is the calling thread.
+    int workers = 1;
+
+    // Current job, generation is bumped every time a new job is posted.
+    Func<void(int, int)> job;
+    int job_threads = 0;
+    int generation = 0;
+    int pending = 0;
+};
+
+// Workers are detached and never stop, the pool is never destroyed either,
+// otherwise we'd have to join them at exit.
+static Pool *pool = new (OrDie) Pool;
+
+static void worker_loop(int index)
+{
+    int seen = 0;
+    for (;;) {
+        Func<void(int, int)> job;
+        int threads;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [&]{ return pool->generation != seen; });
+            seen = pool->generation;
+            if (index >= pool->job_threads)
+                continue;
+            job = pool->job;
+            threads = pool->job_threads;
+        }
+        {
+            TRACE_SCOPE("parallel job");
+            job(index, threads);
+        }
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if (--pool->pending == 0)
+            pool->done.notify_one();
+    }
+}
+
+int hardware_threads()
+{
+    const int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void parallel_run(int thread_count, Func<void(int, int)> f)
+{
+    if (thread_count <= 1) {
+        f(0, 1);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        for (; pool->workers < thread_count; pool->workers++)
+            std::thread(worker_loop, pool->workers).detach();
+        pool->job = f;
+        pool->job_threads = thread_count;
+        pool->pending = thread_count - 1;
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+
+    {
+        TRACE_SCOPE("parallel job");
+        f(0, thread_count);
+    }
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [&]{ return pool->pending == 0; });
+}
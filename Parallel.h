@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Core/Func.h"
+
+// Amount of hardware threads, at least 1.
+int hardware_threads();
+
+// Runs f(thread_index, thread_count) on thread_count threads and waits for all
+// of them to finish. The calling thread is used as thread 0, others come from
+// a pool of persistent worker threads which is started on first use.
+void parallel_run(int thread_count, Func<void(int, int)> f);
+
+// Splits [0, n) into thread_count contiguous ranges and returns the i-th one.
+static inline void parallel_range(int n, int thread_index, int thread_count, int *begin, int *end)
+{
+    *begin = (int)((long long)n * thread_index / thread_count);
+    *end = (int)((long long)n * (thread_index + 1) / thread_count);
+}
@@ -0,0 +1,144 @@
+#include "Perf.h"
+#include "Core/Utils.h"
+#include <string.h>
+#if defined(__linux__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *counter_names[PC_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "dtlb_misses",
+    "branch_misses",
+};
+
+const char *perf_counter_name(PerfCounter c)
+{
+    return counter_names[c];
+}
+
+#if defined(__linux__)
+
+static int fds[PC_COUNT] = {-1, -1, -1, -1, -1, -1};
+
+static uint64_t cache_config(uint64_t cache)
+{
+    return cache |
+        ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+bool perf_open()
+{
+    const uint32_t types[PC_COUNT] = {
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE,
+    };
+    const uint64_t configs[PC_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        cache_config(PERF_COUNT_HW_CACHE_L1D),
+        cache_config(PERF_COUNT_HW_CACHE_LL),
+        cache_config(PERF_COUNT_HW_CACHE_DTLB),
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    int opened = 0;
+    int error = 0;
+    for (int i = 0; i < PC_COUNT; i++) {
+        fds[i] = open_counter(types[i], configs[i]);
+        if (fds[i] == -1)
+            error = errno;
+        else
+            opened++;
+    }
+    if (opened == 0) {
+        warn("perf counters are not available: %s", strerror(error));
+        return false;
+    }
+    for (int i = 0; i < PC_COUNT; i++) {
+        if (fds[i] == -1)
+            warn("perf counter '%s' is not available", counter_names[i]);
+    }
+    return true;
+}
+
+void perf_close()
+{
+    for (int &fd : fds) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+}
+
+void perf_start()
+{
+    for (int fd : fds) {
+        if (fd == -1)
+            continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_stop(PerfValues *out)
+{
+    for (int fd : fds) {
+        if (fd != -1)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (int i = 0; i < PC_COUNT; i++) {
+        // value, time enabled, time running
+        uint64_t v[3];
+        out->values[i] = 0;
+        out->valid[i] = fds[i] != -1 && read(fds[i], v, sizeof(v)) == sizeof(v) && v[2] != 0;
+        if (out->valid[i])
+            out->values[i] = (double)v[0] * ((double)v[1] / (double)v[2]);
+    }
+}
+
+#else
+
+bool perf_open()
+{
+    warn("perf counters are only supported on linux");
+    return false;
+}
+
+void perf_close() {}
+void perf_start() {}
+
+void perf_stop(PerfValues *out)
+{
+    for (int i = 0; i < PC_COUNT; i++) {
+        out->values[i] = 0;
+        out->valid[i] = false;
+    }
+}
+
+#endif
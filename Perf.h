@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hardware performance counters (linux perf_event_open). Counters are opened
+// for the calling thread only, work done by parallel_run workers is not
+// counted.
+enum PerfCounter {
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_L1D_MISSES,
+    PC_LLC_MISSES,
+    PC_DTLB_MISSES,
+    PC_BRANCH_MISSES,
+    PC_COUNT,
+};
+
+struct PerfValues {
+    // Counts scaled up if the kernel had to multiplex counters.
+    double values[PC_COUNT];
+    bool valid[PC_COUNT];
+};
+
+// Opens all the counters which are available. Returns false (and warns) if
+// none are, e.g. if perf events are not supported or not permitted by
+// /proc/sys/kernel/perf_event_paranoid. Everything else is a no-op then.
+bool perf_open();
+void perf_close();
+
+// Counters run between perf_start() and perf_stop(), perf_stop() returns the
+// counts since perf_start().
+void perf_start();
+void perf_stop(PerfValues *out);
+
+// Short name which can be used as a report field, e.g. "l1d_misses".
+const char *perf_counter_name(PerfCounter c);
@@ -0,0 +1,199 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "MemoryStats.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+
+// Point sets: every object has the same radius, so only centers are stored and
+// the radius is folded into the planes once per frame. Sphere test
+//   dot(p.n, s.center) + p.d < -s.radius
+// becomes
+//   dot(p.n, center) + (p.d + radius) < 0
+// and the comparison turns into a sign bit check, no compare instructions are
+// needed at all.
+
+// Same layout as simd_frustum_planes, but not negated and with the radius
+// added to d.
+static void simd_point_planes(__m128 out[8], const Frustum &f, float radius)
+{
+    const Plane *p = f.planes;
+    out[0] = simd_set(p[0].n.x, p[1].n.x, p[2].n.x, p[3].n.x);
+    out[1] = simd_set(p[0].n.y, p[1].n.y, p[2].n.y, p[3].n.y);
+    out[2] = simd_set(p[0].n.z, p[1].n.z, p[2].n.z, p[3].n.z);
+    out[3] = simd_set(p[0].d + radius, p[1].d + radius, p[2].d + radius, p[3].d + radius);
+    out[4] = simd_set(p[4].n.x, p[5].n.x, p[4].n.x, p[5].n.x);
+    out[5] = simd_set(p[4].n.y, p[5].n.y, p[4].n.y, p[5].n.y);
+    out[6] = simd_set(p[4].n.z, p[5].n.z, p[4].n.z, p[5].n.z);
+    out[7] = simd_set(p[4].d + radius, p[5].d + radius, p[4].d + radius, p[5].d + radius);
+}
+
+// Centers are packed 12 bytes each and loaded with an unaligned 16 byte load,
+// the array must have one extra element at the end so that the last load
+// stays in bounds. Results are overwritten.
+static void points_cull(Slice<uint32_t> results, Slice<const Vec3f> centers, const Frustum &f, float radius)
+{
+    TRACE_SCOPE("points_cull");
+    __m128 planes[8];
+    simd_point_planes(planes, f, radius);
+    const int n = centers.length;
+    for (int w = 0, words = (n + 31) / 32; w < words; w++) {
+        uint32_t word = 0;
+        for (int b = 0, i = w * 32, end = min(i + 32, n); i < end; b++, i++) {
+            const __m128 c = _mm_loadu_ps(centers.data[i].data);
+            const __m128 x = simd_splat_x(c);
+            const __m128 y = simd_splat_y(c);
+            const __m128 z = simd_splat_z(c);
+            __m128 v0, v1;
+            v0 = simd_madd(x, planes[0], planes[3]);
+            v0 = simd_madd(y, planes[1], v0);
+            v0 = simd_madd(z, planes[2], v0);
+            v1 = simd_madd(x, planes[4], planes[7]);
+            v1 = simd_madd(y, planes[5], v1);
+            v1 = simd_madd(z, planes[6], v1);
+            word |= (uint32_t)(_mm_movemask_ps(_mm_or_ps(v0, v1)) != 0) << b;
+        }
+        results.data[w] = word;
+    }
+}
+
+// Centers as separate x, y and z arrays, four points per iteration against
+// one plane at a time. Arrays are padded to a multiple of 32 (see
+// generate_data), bits past the end of the last word are cleared.
+static void points_cull_soa(Slice<uint32_t> results, const float *xs, const float *ys, const float *zs,
+    int n, const Frustum &f, float radius)
+{
+    TRACE_SCOPE("points_cull_soa");
+    __m128 nx[6], ny[6], nz[6], d[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm_set1_ps(f.planes[p].n.x);
+        ny[p] = _mm_set1_ps(f.planes[p].n.y);
+        nz[p] = _mm_set1_ps(f.planes[p].n.z);
+        d[p] = _mm_set1_ps(f.planes[p].d + radius);
+    }
+    const int words = (n + 31) / 32;
+    for (int w = 0; w < words; w++) {
+        uint32_t word = 0;
+        for (int j = 0; j < 32; j += 4) {
+            const int i = w * 32 + j;
+            const __m128 x = _mm_load_ps(xs + i);
+            const __m128 y = _mm_load_ps(ys + i);
+            const __m128 z = _mm_load_ps(zs + i);
+            __m128 out = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                __m128 v = simd_madd(x, nx[p], d[p]);
+                v = simd_madd(y, ny[p], v);
+                v = simd_madd(z, nz[p], v);
+                out = _mm_or_ps(out, v);
+            }
+            word |= (uint32_t)_mm_movemask_ps(out) << j;
+        }
+        results.data[w] = word;
+    }
+    if (n % 32 != 0)
+        results.data[words - 1] &= 0xFFFFFFFFU >> (32 - n % 32);
+}
+
+namespace {
+
+struct Data {
+    float radius = 1.0f;
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    // Packed centers with one padding element at the end.
+    Vector<Vec3f> centers = Vector<Vec3f>(&sphere_memory);
+    // SoA centers padded to a multiple of 32 with copies of the last one.
+    Vector<float> xs = Vector<float>(&sphere_memory);
+    Vector<float> ys = Vector<float>(&sphere_memory);
+    Vector<float> zs = Vector<float>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+};
+
+}
+
+enum PointLayout {
+    PointSpheres,
+    PointCenters,
+    PointSoA,
+};
+
+static Data generate_data(const Config &config, PointLayout layout)
+{
+    Data data;
+    const int half_size = config.data_size/2;
+    const int n = volume(Vec3i(config.data_size));
+    Vector<Vec3f> points;
+    Vec3f *out = points.append_uninitialized(n);
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        *out++ = ToVec3f((Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2));
+    }}}
+
+    switch (layout) {
+    case PointSpheres: {
+        Sphere *s = data.spheres.append_uninitialized(n);
+        for (int i = 0; i < n; i++)
+            s[i] = Sphere(points[i], data.radius);
+        break;
+    }
+    case PointCenters:
+        data.centers.reserve(n + 1);
+        data.centers.append_range(points.data(), points.data() + n);
+        data.centers.append(Vec3f(0));
+        break;
+    case PointSoA: {
+        const int padded = (n + 31) / 32 * 32;
+        float *x = data.xs.append_uninitialized(padded);
+        float *y = data.ys.append_uninitialized(padded);
+        float *z = data.zs.append_uninitialized(padded);
+        for (int i = 0; i < padded; i++) {
+            const Vec3f &p = points[min(i, n - 1)];
+            x[i] = p.x;
+            y[i] = p.y;
+            z[i] = p.z;
+        }
+        break;
+    }
+    }
+
+    data.results.resize((n + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    return data;
+}
+
+// args: layout
+static Stats run_points(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    const PointLayout layout = (PointLayout)b.args[0];
+    Data data = generate_data(config, layout);
+    const int n = volume(Vec3i(config.data_size));
+    // Centers are 12 bytes per point, SoA arrays are read up to the padding.
+    const double result_bytes = data.results.length() * sizeof(uint32_t);
+    switch (layout) {
+    case PointSpheres:
+        stats = measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+        break;
+    case PointCenters:
+        stats = measure([&]{ points_cull(data.results, data.centers.sub(0, n), f, data.radius); }, 50, 10, b.name, config,
+            n * sizeof(Vec3f) + result_bytes);
+        break;
+    case PointSoA:
+        stats = measure([&]{
+            points_cull_soa(data.results, data.xs.data(), data.ys.data(), data.zs.data(), n, f, data.radius);
+        }, 50, 10, b.name, config, 3.0 * data.xs.length() * sizeof(float) + result_bytes);
+        break;
+    }
+    print_results(data.results, config);
+    return stats;
+}
+
+void register_points(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_points, {PointSpheres}, "Point set / 16-byte spheres / sse_cull");
+    add_benchmark(list, run_points, {PointCenters}, "Point set / 12-byte centers / shared radius");
+    add_benchmark(list, run_points, {PointSoA}, "Point set / SoA centers     / shared radius");
+}
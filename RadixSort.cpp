@@ -0,0 +1,72 @@
+#include "RadixSort.h"
+#include "Parallel.h"
+#include "Core/Vector.h"
+
+static const int RADIX_BITS = 8;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+
+void radix_sort(Slice<uint64_t> keys, Slice<uint64_t> tmp, int begin_bit, int end_bit, int thread_count)
+{
+    NG_ASSERT(tmp.length >= keys.length);
+    NG_ASSERT(begin_bit >= 0 && end_bit <= 64 && begin_bit <= end_bit);
+    const int n = keys.length;
+    if (n < 2)
+        return;
+    // Not worth splitting small arrays.
+    if (n < 4096 * thread_count)
+        thread_count = 1;
+
+    // offsets[t * RADIX_SIZE + d] is a histogram first and then a starting
+    // position for digit d of thread t.
+    Vector<int> offsets(thread_count * RADIX_SIZE);
+    uint64_t *src = keys.data;
+    uint64_t *dst = tmp.data;
+    for (int shift = begin_bit; shift < end_bit; shift += RADIX_BITS) {
+        const uint64_t mask = end_bit - shift < RADIX_BITS ?
+            (1ULL << (end_bit - shift)) - 1 : RADIX_SIZE - 1;
+
+        auto count = [&](int t, int threads) {
+            int begin, end;
+            parallel_range(n, t, threads, &begin, &end);
+            int *hist = offsets.data() + t * RADIX_SIZE;
+            for (int d = 0; d < RADIX_SIZE; d++)
+                hist[d] = 0;
+            for (int i = begin; i < end; i++)
+                hist[(src[i] >> shift) & mask]++;
+        };
+        parallel_run(thread_count, count);
+
+        // Thread t writes digit d after all smaller digits and after digit d
+        // of threads before t, this keeps the sort stable.
+        int sum = 0;
+        bool skip = false;
+        for (int d = 0; d < RADIX_SIZE; d++) {
+            const int digit_begin = sum;
+            for (int t = 0; t < thread_count; t++) {
+                const int c = offsets[t * RADIX_SIZE + d];
+                offsets[t * RADIX_SIZE + d] = sum;
+                sum += c;
+            }
+            // All the keys have the same digit, nothing to do on this pass.
+            if (sum - digit_begin == n)
+                skip = true;
+        }
+        if (skip)
+            continue;
+
+        auto scatter = [&](int t, int threads) {
+            int begin, end;
+            parallel_range(n, t, threads, &begin, &end);
+            int *pos = offsets.data() + t * RADIX_SIZE;
+            for (int i = begin; i < end; i++) {
+                const uint64_t k = src[i];
+                dst[pos[(k >> shift) & mask]++] = k;
+            }
+        };
+        parallel_run(thread_count, scatter);
+        std::swap(src, dst);
+    }
+
+    if (src != keys.data)
+        copy_memory(keys.data, src, n);
+}
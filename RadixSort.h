@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include "Core/Slice.h"
+
+// Stable LSD radix sort of 64-bit keys, only bits [begin_bit, end_bit) are
+// used for sorting, the rest is payload (usually an index in lower 32 bits).
+// tmp should be at least as long as keys. Each 8-bit pass is split between
+// thread_count threads.
+void radix_sort(Slice<uint64_t> keys, Slice<uint64_t> tmp, int begin_bit, int end_bit, int thread_count);
@@ -0,0 +1,302 @@
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include "Math/Frustum.h"
+#include <random>
+#include <algorithm>
+
+// Keeps spheres sorted by Morton code of their centers. Culling results refer
+// to positions in the sorted array, ids and mapping translate them to
+// original object ids and back.
+struct MortonOrder {
+    // Centers are quantized to 10 bits per axis: (p - min) * scale.
+    Vec3f min;
+    Vec3f scale;
+
+    // Morton code in upper 32 bits, position in the array before sorting in
+    // lower 32 bits.
+    Vector<uint64_t> keys = Vector<uint64_t>(&key_memory);
+    Vector<uint64_t> tmp = Vector<uint64_t>(&key_memory);
+    Vector<uint64_t> moved = Vector<uint64_t>(&key_memory);
+    Vector<Sphere> scratch = Vector<Sphere>(&sphere_memory);
+
+    // Position in the sorted array -> original id. Can be filled before the
+    // first sort to use custom ids, identity is used otherwise.
+    Vector<int> ids = Vector<int>(&mapping_memory);
+    Vector<int> ids_tmp = Vector<int>(&mapping_memory);
+
+    // Original id -> position in the sorted array. Same as Data::mapping in
+    // Arrays.cpp.
+    Vector<int> mapping = Vector<int>(&mapping_memory);
+};
+
+static void compute_keys(MortonOrder *o, Slice<const Sphere> spheres, int threads)
+{
+    o->keys.resize(spheres.length);
+    auto job = [&](int t, int thread_count) {
+        int begin, end;
+        parallel_range(spheres.length, t, thread_count, &begin, &end);
+        for (int i = begin; i < end; i++) {
+            const Vec3f q = (spheres.data[i].center - o->min) * o->scale;
+            const Vec3i p(clamp<int>(q.x, 0, 1023), clamp<int>(q.y, 0, 1023), clamp<int>(q.z, 0, 1023));
+            o->keys.data()[i] = ((uint64_t)morton_encode(p) << 32) | (uint32_t)i;
+        }
+    };
+    parallel_run(threads, job);
+}
+
+// Moves spheres and ids according to sorted keys.
+static void apply_permutation(MortonOrder *o, Vector<Sphere> *spheres, int threads)
+{
+    const int n = spheres->length();
+    o->scratch.resize(n);
+    o->ids_tmp.resize(n);
+    o->mapping.resize(n);
+    auto job = [&](int t, int thread_count) {
+        int begin, end;
+        parallel_range(n, t, thread_count, &begin, &end);
+        for (int i = begin; i < end; i++) {
+            const int src = o->keys.data()[i] & 0xFFFFFFFF;
+            const int id = o->ids.data()[src];
+            o->scratch.data()[i] = spheres->data()[src];
+            o->ids_tmp.data()[i] = id;
+            o->mapping.data()[id] = i;
+        }
+    };
+    parallel_run(threads, job);
+    std::swap(*spheres, o->scratch);
+    std::swap(o->ids, o->ids_tmp);
+}
+
+// Full reorder, recomputes quantization bounds and radix sorts all the keys.
+static void morton_reorder(MortonOrder *o, Vector<Sphere> *spheres, int threads)
+{
+    const int n = spheres->length();
+    if (n == 0)
+        return;
+    if (o->ids.length() != n) {
+        o->ids.resize(n);
+        for (int i = 0; i < n; i++)
+            o->ids[i] = i;
+    }
+
+    Vec3f bmin, bmax;
+    sse_sphere_bounds(*spheres, &bmin, &bmax);
+    o->min = bmin;
+    o->scale = Vec3f(1023.99f) / max(bmax - bmin, Vec3f(MATH_EPSILON));
+
+    compute_keys(o, *spheres, threads);
+    o->tmp.resize(n);
+    radix_sort(o->keys, o->tmp, 32, 62, threads);
+    apply_permutation(o, spheres, threads);
+}
+
+// Re-sorts spheres after they moved, keeps quantization bounds from the last
+// full reorder. Small motions leave the array almost sorted: keys which are out
+// of place are pulled out, sorted separately and merged back, which is much
+// cheaper than a full radix sort.
+static void morton_reorder_incremental(MortonOrder *o, Vector<Sphere> *spheres, int threads)
+{
+    const int n = spheres->length();
+    if (o->ids.length() != n) {
+        morton_reorder(o, spheres, threads);
+        return;
+    }
+
+    compute_keys(o, *spheres, threads);
+    uint64_t *keys = o->keys.data();
+    int descents = 0;
+    for (int i = 1; i < n; i++)
+        descents += keys[i] < keys[i-1];
+    if (descents == 0)
+        return;
+
+    // A key is out of place if it breaks the order with one of its neighbours,
+    // on top of that the kept keys must stay sorted.
+    o->tmp.resize(n);
+    o->moved.clear();
+    uint64_t *kept = o->tmp.data();
+    int kept_count = 0;
+    for (int i = 0; i < n; i++) {
+        const uint64_t k = keys[i];
+        const bool out_of_place = (i > 0 && keys[i-1] > k) || (i + 1 < n && k > keys[i+1]);
+        if (!out_of_place && (kept_count == 0 || kept[kept_count-1] <= k))
+            kept[kept_count++] = k;
+        else
+            o->moved.append(k);
+    }
+
+    if (o->moved.length() > n / 8) {
+        radix_sort(o->keys, o->tmp, 32, 62, threads);
+    } else {
+        sort(o->moved.sub());
+        std::merge(kept, kept + kept_count, o->moved.data(), o->moved.data() + o->moved.length(), keys);
+    }
+    apply_permutation(o, spheres, threads);
+}
+
+// Translates results indexed by sorted position into results indexed by
+// original id. Every output word is gathered from 32 input bits in a register
+// without branches, so there is no read-modify-write on the output and the
+// compiler is free to vectorize the inner loop (SSE2 has no gathers or
+// per-lane shifts, but AVX2 does).
+static void remap_results(Slice<uint32_t> out, Slice<const uint32_t> results, Slice<const int> mapping)
+{
+    const int n = mapping.length;
+    const int full_words = n / 32;
+    const int *m = mapping.data;
+    const uint32_t *r = results.data;
+    for (int w = 0; w < full_words; w++) {
+        uint32_t word = 0;
+        for (int b = 0; b < 32; b++) {
+            const int pos = m[w * 32 + b];
+            word |= ((r[pos >> 5] >> (pos & 31)) & 1) << b;
+        }
+        out.data[w] = word;
+    }
+    if (full_words * 32 < n) {
+        uint32_t word = 0;
+        for (int b = 0, i = full_words * 32; i < n; i++, b++) {
+            const int pos = m[i];
+            word |= ((r[pos >> 5] >> (pos & 31)) & 1) << b;
+        }
+        out.data[full_words] = word;
+    }
+}
+
+namespace {
+
+struct Data {
+    // Spheres in spawn order, shuffled grid positions.
+    Vector<Sphere> spawned = Vector<Sphere>(&sphere_memory);
+    // Grid position of each spawned sphere.
+    Vector<int> spawned_ids = Vector<int>(&mapping_memory);
+
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+    Vector<uint32_t> remapped = Vector<uint32_t>(&result_memory);
+    MortonOrder order;
+
+    // Objects which move back and forth between incremental reorders, ids
+    // refer to grid positions.
+    Vector<int> moving = Vector<int>(&motion_memory);
+    Vector<Vec3f> deltas = Vector<Vec3f>(&motion_memory);
+    int frame = 0;
+};
+
+}
+
+static Data generate_data(const Config &config, float moving_fraction)
+{
+    Data data;
+    const int half_size = config.data_size/2;
+    Sphere *s = data.spawned.append_uninitialized(volume(Vec3i(config.data_size)));
+    for (int z = 0; z < config.data_size; z++) {
+    for (int y = 0; y < config.data_size; y++) {
+    for (int x = 0; x < config.data_size; x++) {
+        const Vec3i p = (Vec3i(x, y, z) - Vec3i(half_size)) * Vec3i(2);
+        *s++ = Sphere(ToVec3f(p), 1.0f);
+        data.spawned_ids.append(data.spawned_ids.length());
+    }}}
+
+    std::default_random_engine rng(config.seed);
+    for (int i = data.spawned.length() - 1; i > 0; i--) {
+        const int j = std::uniform_int_distribution<int>(0, i)(rng);
+        std::swap(data.spawned[i], data.spawned[j]);
+        std::swap(data.spawned_ids[i], data.spawned_ids[j]);
+    }
+
+    data.spheres = data.spawned;
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    data.remapped.resize(data.results.length());
+    fill<uint32_t>(data.remapped, 0);
+
+    std::uniform_real_distribution<float> offset(-1.5f, 1.5f);
+    const int moving_count = data.spheres.length() * moving_fraction;
+    for (int i = 0; i < moving_count; i++) {
+        data.moving.append(std::uniform_int_distribution<int>(0, data.spheres.length() - 1)(rng));
+        data.deltas.append(Vec3f(offset(rng), offset(rng), offset(rng)));
+    }
+    return data;
+}
+
+static void reset_order(Data *data)
+{
+    data->spheres = data->spawned;
+    data->order.ids = data->spawned_ids;
+}
+
+static void move_objects(Data *data)
+{
+    const float sign = data->frame++ % 2 == 1 ? -1.0f : 1.0f;
+    for (int i = 0, n = data->moving.length(); i < n; i++) {
+        const int pos = data->order.mapping[data->moving[i]];
+        data->spheres[pos].center += data->deltas[i] * Vec3f(sign);
+    }
+}
+
+enum ReorderMode {
+    SpawnOrderNaive,
+    FullSort,
+    Incremental,
+    SortedNaive,
+    SortedSSE,
+    Remap,
+};
+
+// args: mode, threads (0 means config.threads)
+static Stats run_reorder(const Benchmark &b, const Config &config)
+{
+    Stats stats;
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    const int threads = b.args[1] != 0 ? b.args[1] : config.threads;
+    Data data = generate_data(config, 0.01f);
+    const ReorderMode mode = (ReorderMode)b.args[0];
+    if (mode == SpawnOrderNaive) {
+        stats = measure([&]{ naive_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+        return stats;
+    }
+    if (mode == FullSort) {
+        stats = measure([&]{ reset_order(&data); morton_reorder(&data.order, &data.spheres, threads); }, 5, 10, b.name, config);
+        return stats;
+    }
+
+    reset_order(&data);
+    morton_reorder(&data.order, &data.spheres, threads);
+    switch (mode) {
+    case Incremental:
+        stats = measure([&]{ move_objects(&data); morton_reorder_incremental(&data.order, &data.spheres, threads); }, 50, 10, b.name, config);
+        break;
+    case SortedNaive:
+        stats = measure([&]{ naive_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+        break;
+    case SortedSSE:
+        stats = measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+        break;
+    case Remap:
+        sse_cull(data.results, data.spheres, f);
+        stats = measure([&]{ remap_results(data.remapped, data.results, data.order.mapping); }, 50, 10, b.name, config);
+        print_results(data.remapped, config);
+        break;
+    default:
+        break;
+    }
+    return stats;
+}
+
+void register_reorder(BenchmarkList *list)
+{
+    begin_group(list);
+    add_benchmark(list, run_reorder, {SpawnOrderNaive}, "Morton reorder / spawn order / naive_cull");
+    add_benchmark(list, run_reorder, {FullSort, 1}, "Morton reorder / full sort / 1 thread");
+    add_benchmark(list, run_reorder, {FullSort}, "Morton reorder / full sort / all threads");
+    add_benchmark(list, run_reorder, {Incremental}, "Morton reorder / incremental / 1%% moving");
+    add_benchmark(list, run_reorder, {SortedNaive}, "Morton reorder / sorted / naive_cull");
+    add_benchmark(list, run_reorder, {SortedSSE}, "Morton reorder / sorted / sse_cull");
+    add_benchmark(list, run_reorder, {Remap}, "Morton reorder / sorted / remap to ids");
+}
@@ -0,0 +1,128 @@
+#include "Report.h"
+#include "Core/Utils.h"
+#include "Core/Vector.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+static FILE *csv_file = nullptr;
+static FILE *json_file = nullptr;
+static int records = 0;
+// Keys of the last CSV header.
+static Vector<const char*> csv_columns;
+
+// CSV escapes quotes by doubling them, backslashes have no special meaning.
+static void write_csv_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Non-finite values (a ratio with a zero mean, a missing counter) are
+// written as empty CSV cells and JSON nulls.
+static void write_csv_value(FILE *f, double value)
+{
+    if (isfinite(value))
+        fprintf(f, "%.9g", value);
+}
+
+static void write_json_value(FILE *f, double value)
+{
+    if (isfinite(value))
+        fprintf(f, "%.9g", value);
+    else
+        fprintf(f, "null");
+}
+
+void open_reports(const char *csv_path, const char *json_path)
+{
+    if (csv_path) {
+        csv_file = fopen(csv_path, "w");
+        if (!csv_file)
+            die("failed to open %s", csv_path);
+    }
+    if (json_path) {
+        json_file = fopen(json_path, "w");
+        if (!json_file)
+            die("failed to open %s", json_path);
+        fprintf(json_file, "[\n");
+    }
+}
+
+void close_reports()
+{
+    if (csv_file) {
+        fclose(csv_file);
+        csv_file = nullptr;
+    }
+    if (json_file) {
+        fprintf(json_file, "\n]\n");
+        fclose(json_file);
+        json_file = nullptr;
+    }
+}
+
+static bool same_columns(Slice<const ReportField> fields)
+{
+    if (fields.length != csv_columns.length())
+        return false;
+    for (int i = 0; i < fields.length; i++) {
+        if (strcmp(fields.data[i].key, csv_columns[i]) != 0)
+            return false;
+    }
+    return true;
+}
+
+void report(const char *name, Slice<const ReportField> fields)
+{
+    if (csv_file) {
+        // Records are expected to have the same fields, but if they don't,
+        // a new header is started rather than shifting values under the
+        // wrong columns.
+        if (records == 0 || !same_columns(fields)) {
+            csv_columns.clear();
+            fprintf(csv_file, "name");
+            for (const ReportField &f : fields) {
+                fprintf(csv_file, ",%s", f.key);
+                csv_columns.append(f.key);
+            }
+            fprintf(csv_file, "\n");
+        }
+        write_csv_string(csv_file, name);
+        for (const ReportField &f : fields) {
+            fputc(',', csv_file);
+            write_csv_value(csv_file, f.value);
+        }
+        fprintf(csv_file, "\n");
+        fflush(csv_file);
+    }
+    if (json_file) {
+        fprintf(json_file, "%s  {\"name\": ", records == 0 ? "" : ",\n");
+        write_json_string(json_file, name);
+        for (const ReportField &f : fields) {
+            fprintf(json_file, ", ");
+            write_json_string(json_file, f.key);
+            fprintf(json_file, ": ");
+            write_json_value(json_file, f.value);
+        }
+        fprintf(json_file, "}");
+        fflush(json_file);
+    }
+    records++;
+}
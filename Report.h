@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Core/Slice.h"
+
+// Machine-readable benchmark results. Every measured benchmark produces one
+// record, a name and a list of numeric fields. The first record defines CSV
+// columns, so all records are expected to have the same fields; a record with
+// different fields starts a new CSV header. Non-finite values are written as
+// empty CSV cells and JSON nulls.
+struct ReportField {
+    const char *key;
+    double value;
+};
+
+// Either path can be null, which disables that format.
+void open_reports(const char *csv_path, const char *json_path);
+void close_reports();
+void report(const char *name, Slice<const ReportField> fields);
@@ -1,17 +1,71 @@
 #include <stdio.h>
 #include "Common.h"
+#include "Benchmark.h"
+#include "Report.h"
+#include "Perf.h"
+#include "Bandwidth.h"
+#include "Antagonist.h"
+#include "Trace.h"
+#include "Timer.h"
 
 int main(int argc, char **argv)
 {
     Config config;
     parse_args(&config, argc, argv);
 
+    BenchmarkList list;
+    register_arrays(&list);
+    register_chunks(&list);
+    register_dynamic(&list);
+    register_octree(&list);
+    register_grid(&list);
+    register_reorder(&list);
+    register_scenes(&list);
+    register_points(&list);
+    register_lod(&list);
+    register_depth_sort(&list);
+    register_camera_paths(&list, config);
+    if (config.list) {
+        run_benchmarks(list, config);
+        return 0;
+    }
+
+    open_reports(config.csv_path, config.json_path);
+    if (config.perf)
+        config.perf = perf_open();
+
     printf("Data size: %dx%dx%d (%d objects, %zu bytes)\n",
         config.data_size, config.data_size, config.data_size,
         volume(Vec3i(config.data_size)),
         volume(Vec3i(config.data_size)) * sizeof(Sphere));
 
-    do_arrays(config);
-    do_chunks(config);
+    printf("TSC: %.3f GHz\n", tsc_ticks_per_millisecond() / 1e6);
+
+    if (config.bandwidth_probe) {
+        // 64MB per array is well past the LLC on most desktop CPUs.
+        const Bandwidth bw = measure_bandwidth(64 * 1024 * 1024);
+        printf("Memory bandwidth: read %.2f GB/s, copy %.2f GB/s, triad %.2f GB/s\n",
+            bw.read, bw.copy, bw.triad);
+        config.bandwidth = bw.read;
+    }
+
+    const int antagonists = config.antagonist_streaming + config.antagonist_chasing;
+    if (antagonists != 0) {
+        printf("Antagonists: %d streaming, %d pointer chasing, 64MB each\n",
+            config.antagonist_streaming, config.antagonist_chasing);
+        start_antagonists(config.antagonist_streaming, config.antagonist_chasing, 64 * 1024 * 1024);
+    }
+
+    if (config.sweep)
+        run_sweep(list, config);
+    else
+        run_benchmarks(list, config);
+    if (antagonists != 0)
+        stop_antagonists();
+    if (config.trace_path && !trace_dump(config.trace_path))
+        warn("tracing is compiled out, configure with -DSSECULLING_TRACE=ON");
+    if (config.perf)
+        perf_close();
+    close_reports();
     return 0;
 }
@@ -0,0 +1,136 @@
+#include "Scene.h"
+#include "Common.h"
+#include "Benchmark.h"
+#include "MemoryStats.h"
+#include <cmath>
+#include <stdio.h>
+
+typedef std::uniform_real_distribution<float> Uniform;
+
+// Same as the grid used by the other benchmarks, but with count spheres.
+static void generate_grid(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng)
+{
+    const int size = std::max(1, (int)std::ceil(std::cbrt((double)count)));
+    const float spacing = 2.0f * extent / size;
+    for (int i = 0; i < count; i++) {
+        const Vec3i p(i % size, i / size % size, i / (size * size));
+        out->pappend(ToVec3f(p - Vec3i(size / 2)) * Vec3f(spacing), 1.0f);
+    }
+}
+
+// Cities: dense gaussian clusters of small and medium objects scattered over
+// a flat area, empty space in between.
+static void generate_clustered(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng)
+{
+    const int clusters = std::max(1, count / 2000);
+    Uniform center(-extent, extent);
+    Uniform height(-extent * 0.25f, extent * 0.25f);
+    Uniform radius(0.25f, 2.0f);
+    std::normal_distribution<float> spread(0.0f, extent * 0.05f);
+    for (int c = 0; c < clusters; c++) {
+        const Vec3f cc(center(rng), height(rng), center(rng));
+        const int n = (count - out->length()) / (clusters - c);
+        for (int i = 0; i < n; i++)
+            out->pappend(cc + Vec3f(spread(rng), spread(rng) * 0.25f, spread(rng)), radius(rng));
+    }
+}
+
+// Uniform positions, Pareto distributed radii: lots of small objects and a
+// few huge ones, which are almost always visible.
+static void generate_power_law(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng)
+{
+    const float alpha = 2.5f;
+    const float min_radius = 0.25f;
+    const float max_radius = extent * 0.25f;
+    Uniform pos(-extent, extent);
+    Uniform u(0.0f, 1.0f);
+    for (int i = 0; i < count; i++) {
+        const float r = min_radius * std::pow(1.0f - u(rng), -1.0f / alpha);
+        out->pappend(Vec3f(pos(rng), pos(rng), pos(rng)), std::min(r, max_radius));
+    }
+}
+
+// Open world: objects sparsely spread over an area far larger than the view
+// distance, most of them are culled.
+static void generate_open_world(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng)
+{
+    Uniform ground(-extent * 8.0f, extent * 8.0f);
+    Uniform height(-extent * 0.1f, extent * 0.1f);
+    Uniform radius(1.0f, 4.0f);
+    for (int i = 0; i < count; i++)
+        out->pappend(Vec3f(ground(rng), height(rng), ground(rng)), radius(rng));
+}
+
+// Interior: a small room packed with clutter around the camera, most objects
+// are within the view distance and culling is decided by the side planes.
+static void generate_interior(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng)
+{
+    const float room = std::min(extent, 20.0f);
+    Uniform pos(-room, room);
+    Uniform radius(0.05f, 0.5f);
+    for (int i = 0; i < count; i++)
+        out->pappend(Vec3f(pos(rng), pos(rng), pos(rng)), radius(rng));
+}
+
+static const SceneGenerator generators[] = {
+    {"grid", generate_grid},
+    {"clustered", generate_clustered},
+    {"power law", generate_power_law},
+    {"open world", generate_open_world},
+    {"interior", generate_interior},
+};
+
+Slice<const SceneGenerator> scene_generators()
+{
+    return generators;
+}
+
+namespace {
+
+struct Data {
+    Vector<Sphere> spheres = Vector<Sphere>(&sphere_memory);
+    Vector<uint32_t> results = Vector<uint32_t>(&result_memory);
+};
+
+}
+
+static Data generate_data(const SceneGenerator &g, const Config &config)
+{
+    Data data;
+    std::default_random_engine rng(config.seed);
+    const int count = volume(Vec3i(config.data_size));
+    g.generate(&data.spheres, count, config.data_size, rng);
+    data.results.resize((data.spheres.length() + 31) / 32);
+    fill<uint32_t>(data.results, 0);
+    return data;
+}
+
+static void print_visibility(const Data &data)
+{
+    const int n = data.spheres.length();
+    int culled = 0;
+    for (int i = 0; i < n; i++)
+        culled += (data.results[i / 32] >> (i % 32)) & 1;
+    printf("  visible: %.1f%%\n", (n - culled) * 100.0 / n);
+}
+
+// args: generator index, 1 to use sse_cull
+static Stats run_scene(const Benchmark &b, const Config &config)
+{
+    const Frustum f = Frustum_Perspective(75.0f, 1.333f, 0.5f, 100.0f);
+    Data data = generate_data(generators[b.args[0]], config);
+    const Stats stats = b.args[1] == 0 ?
+        measure([&]{ naive_cull(data.results, data.spheres, f); }, 50, 10, b.name, config) :
+        measure([&]{ sse_cull(data.results, data.spheres, f); }, 50, 10, b.name, config);
+    print_visibility(data);
+    return stats;
+}
+
+void register_scenes(BenchmarkList *list)
+{
+    begin_group(list);
+    for (int i = 0, n = sizeof(generators) / sizeof(generators[0]); i < n; i++) {
+        add_benchmark(list, run_scene, {i, 0}, "Scene / %-10s / naive_cull", generators[i].name);
+        add_benchmark(list, run_scene, {i, 1}, "Scene / %-10s / sse_cull", generators[i].name);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Core/Vector.h"
+#include "Math/Sphere.h"
+#include <random>
+
+// Scene generators, they append count spheres to out. Scenes are centered at
+// the origin and roughly extent units in each direction, same as the default
+// grid of data_size^3 unit spheres spaced 2 units apart. Spheres come in the
+// order a level would load them, not sorted or shuffled.
+struct SceneGenerator {
+    const char *name;
+    void (*generate)(Vector<Sphere> *out, int count, float extent, std::default_random_engine &rng);
+};
+
+// All the generators, the uniform grid goes first.
+Slice<const SceneGenerator> scene_generators();
@@ -0,0 +1,60 @@
+#include "Stats.h"
+#include "Core/Vector.h"
+#include <cmath>
+
+// Two-sided 95% critical values of Student's t distribution for 1-30 degrees
+// of freedom, normal distribution is close enough after that.
+static const double t_table[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+double student_t95(int dof)
+{
+    if (dof < 1)
+        return 0;
+    if (dof <= 30)
+        return t_table[dof-1];
+    return 1.96;
+}
+
+double percentile(Slice<const double> sorted, double p)
+{
+    if (sorted.length == 0)
+        return 0;
+    const double rank = p / 100.0 * (sorted.length - 1);
+    const int lo = (int)rank;
+    const int hi = lo + 1 < sorted.length ? lo + 1 : lo;
+    const double frac = rank - lo;
+    return sorted.data[lo] + (sorted.data[hi] - sorted.data[lo]) * frac;
+}
+
+Stats compute_stats(Slice<const double> samples)
+{
+    Stats s;
+    s.count = samples.length;
+    if (s.count == 0)
+        return s;
+
+    Vector<double> sorted(samples);
+    sort(sorted.sub());
+
+    double sum = 0;
+    for (double v : samples)
+        sum += v;
+    s.mean = sum / s.count;
+
+    double sq = 0;
+    for (double v : samples)
+        sq += (v - s.mean) * (v - s.mean);
+    s.stddev = s.count > 1 ? std::sqrt(sq / (s.count - 1)) : 0;
+    s.ci95 = student_t95(s.count - 1) * s.stddev / std::sqrt((double)s.count);
+
+    s.min = sorted.first();
+    s.max = sorted.last();
+    s.median = percentile(sorted, 50);
+    s.p90 = percentile(sorted, 90);
+    s.p99 = percentile(sorted, 99);
+    return s;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Core/Slice.h"
+
+// Summary of a set of samples (usually run times in milliseconds).
+struct Stats {
+    int count = 0;
+    double mean = 0;
+    double median = 0;
+    double min = 0;
+    double max = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double stddev = 0;
+    // Half-width of the 95% confidence interval of the mean.
+    double ci95 = 0;
+};
+
+Stats compute_stats(Slice<const double> samples);
+
+// Linearly interpolated percentile, p is in [0, 100] and samples should be
+// sorted.
+double percentile(Slice<const double> sorted, double p);
+
+// Two-sided 95% critical value of Student's t distribution.
+double student_t95(int degrees_of_freedom);
@@ -0,0 +1,82 @@
+#include "Benchmark.h"
+#include "CacheInfo.h"
+#include "MemoryStats.h"
+#include <stdio.h>
+#include <math.h>
+
+// Working set of a scene: spheres plus result bits.
+static double scene_bytes(int data_size)
+{
+    return array_bytes(volume(Vec3i(data_size)));
+}
+
+static const char *cache_level(double bytes, const CacheInfo &caches)
+{
+    if (bytes <= caches.l1d)
+        return "L1";
+    if (bytes <= caches.l2)
+        return "L2";
+    if (caches.l3 != 0 && bytes <= caches.l3)
+        return "L3";
+    return "DRAM";
+}
+
+void run_sweep(const BenchmarkList &list, const Config &config)
+{
+    // Everything at DRAM sizes takes a while, plain array kernels are the
+    // default.
+    Config c = config;
+    if (!c.filter)
+        c.filter = "^(Naive|SSE) culling / (structured|random) data";
+
+    Vector<const Benchmark*> selected;
+    select_benchmarks(&selected, list, c);
+    if (selected.length() == 0)
+        return;
+
+    const CacheInfo caches = detect_caches();
+    const int llc = last_level_cache(caches);
+    printf("Caches: L1d %dK, L2 %dK, L3 %dK\n", caches.l1d / 1024, caches.l2 / 1024, caches.l3 / 1024);
+
+    // Sizes double from half of L1d to 8x LLC, but no more than 512MB.
+    Vector<int> sizes;
+    const double max_bytes = min(8.0 * llc, 512.0 * 1024 * 1024);
+    for (double bytes = caches.l1d / 2; bytes <= max_bytes; bytes *= 2) {
+        const int n = max(2, (int)round(cbrt(bytes / sizeof(Sphere))));
+        if (sizes.length() == 0 || sizes.last() != n)
+            sizes.append(n);
+    }
+
+    // Millions of spheres per second, [size][benchmark].
+    Vector<double> table;
+    for (int n : sizes) {
+        c.data_size = n;
+        printf("----------------------------------------\n");
+        printf("Data size: %dx%dx%d (%.1fK working set, %s)\n",
+            n, n, n, scene_bytes(n) / 1024, cache_level(scene_bytes(n), caches));
+        for (const Benchmark *b : selected) {
+            memory_stats_reset();
+            const Stats stats = b->run(*b, c);
+            table.append(stats.mean > 0 ? volume(Vec3i(n)) / (stats.mean * 1000.0) : 0);
+        }
+    }
+
+    printf("----------------------------------------\n");
+    printf("Throughput vs working set size, M spheres/s:\n");
+    for (int i = 0; i < selected.length(); i++)
+        printf("  [%d] %s\n", i, selected[i]->name);
+    printf("%12s %5s", "size", "level");
+    for (int i = 0; i < selected.length(); i++) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "[%d]", i);
+        printf(" %8s", buf);
+    }
+    printf("\n");
+    for (int s = 0; s < sizes.length(); s++) {
+        const double bytes = scene_bytes(sizes[s]);
+        printf("%11.1fK %5s", bytes / 1024, cache_level(bytes, caches));
+        for (int i = 0; i < selected.length(); i++)
+            printf(" %8.1f", table[s * selected.length() + i]);
+        printf("\n");
+    }
+}
@@ -7,6 +7,7 @@
 #else
 #include <time.h>
 #endif
+#include "Timer.h"
 #include "Core/Utils.h"
 
 double get_time_milliseconds()
@@ -41,3 +42,35 @@ double get_time_milliseconds()
     return (double)t.tv_sec * 1000.0 + (double)t.tv_nsec / 1000000.0;
 #endif
 }
+
+// Counts ticks over a 10ms busy wait a few times and takes the median, which
+// throws away attempts disturbed by preemption between the two clock reads.
+static double calibrate_tsc()
+{
+    const int attempts = 5;
+    double rates[attempts];
+    for (int i = 0; i < attempts; i++) {
+        const double begin_ms = get_time_milliseconds();
+        const uint64_t begin = tsc_begin();
+        double now_ms;
+        do {
+            now_ms = get_time_milliseconds();
+        } while (now_ms - begin_ms < 10.0);
+        const uint64_t end = tsc_end();
+        rates[i] = (end - begin) / (now_ms - begin_ms);
+    }
+    for (int i = 1; i < attempts; i++) {
+        for (int j = i; j > 0 && rates[j] < rates[j-1]; j--) {
+            const double t = rates[j];
+            rates[j] = rates[j-1];
+            rates[j-1] = t;
+        }
+    }
+    return rates[attempts / 2];
+}
+
+double tsc_ticks_per_millisecond()
+{
+    static const double rate = calibrate_tsc();
+    return rate;
+}
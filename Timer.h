@@ -1,3 +1,46 @@
 #pragma once
 
+#include <stdint.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
 double get_time_milliseconds();
+
+// TSC based timer for short intervals. Reads are ordered with fences so that
+// the measured code can't move out of the interval: lfence before rdtsc waits
+// for earlier instructions to finish, rdtscp waits for the measured code and
+// lfence after it keeps later instructions from starting early.
+//
+//     const uint64_t begin = tsc_begin();
+//     ...
+//     const uint64_t ticks = tsc_end() - begin;
+//
+// TSC ticks at a constant rate on all modern x86 CPUs, which is not
+// necessarily the rate of core clock cycles.
+static inline uint64_t tsc_begin()
+{
+    _mm_lfence();
+    const uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+
+static inline uint64_t tsc_end()
+{
+    unsigned int aux;
+    const uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+
+// TSC ticks per millisecond, calibrated against the monotonic clock on first
+// use (takes a few tens of milliseconds).
+double tsc_ticks_per_millisecond();
+
+static inline double tsc_to_milliseconds(uint64_t ticks)
+{
+    return ticks / tsc_ticks_per_millisecond();
+}
@@ -0,0 +1,97 @@
+#include "Trace.h"
+#include "Core/Utils.h"
+#include <stdio.h>
+
+#if defined(SSECULLING_TRACE)
+
+#include "Timer.h"
+#include "Core/Vector.h"
+#include <mutex>
+
+struct TraceEvent {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct TraceBuffer {
+    // Power of two, ~1.5MB per thread.
+    static const int capacity = 1 << 16;
+    TraceEvent events[capacity];
+    // Total amount of events ever recorded, the last capacity of them are kept.
+    uint64_t count = 0;
+    int tid = 0;
+};
+
+// Buffers are registered once per thread and never freed, worker threads
+// never exit anyway.
+static std::mutex buffers_mutex;
+static Vector<TraceBuffer*> buffers;
+static thread_local TraceBuffer *buffer = nullptr;
+
+// Timestamps are written relative to startup.
+static const uint64_t start_tsc = trace_timestamp();
+
+static TraceBuffer *register_buffer()
+{
+    TraceBuffer *b = new (OrDie) TraceBuffer;
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    b->tid = buffers.length();
+    buffers.append(b);
+    return b;
+}
+
+void trace_event(const char *name, uint64_t begin, uint64_t end)
+{
+    if (!buffer)
+        buffer = register_buffer();
+    buffer->events[buffer->count++ & (TraceBuffer::capacity - 1)] = {name, begin, end};
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+bool trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        die("failed to open %s", path);
+
+    const double ticks_per_us = tsc_ticks_per_millisecond() / 1000.0;
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char *sep = "";
+    for (const TraceBuffer *b : buffers) {
+        fprintf(f, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+            sep, b->tid, b->tid);
+        sep = ",\n";
+        const uint64_t first = b->count > (uint64_t)TraceBuffer::capacity ? b->count - TraceBuffer::capacity : 0;
+        for (uint64_t i = first; i < b->count; i++) {
+            const TraceEvent &e = b->events[i & (TraceBuffer::capacity - 1)];
+            fprintf(f, "%s  {\"name\": ", sep);
+            write_json_string(f, e.name);
+            fprintf(f, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                b->tid, (e.begin - start_tsc) / ticks_per_us, (e.end - e.begin) / ticks_per_us);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
+
+#else
+
+bool trace_dump(const char *path)
+{
+    return false;
+}
+
+#endif
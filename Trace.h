@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timeline of culling work which can be loaded into Perfetto or
+// chrome://tracing. Enabled with the SSECULLING_TRACE cmake option, otherwise
+// TRACE_SCOPE expands to nothing and costs nothing.
+//
+// Every thread records complete events (name, begin and end TSC timestamps)
+// into its own ring buffer, no locks or atomics on the recording path. When a
+// buffer is full the oldest events are overwritten. Names must be string
+// literals or otherwise outlive trace_dump().
+
+#if defined(SSECULLING_TRACE)
+
+#include "Timer.h"
+
+// Plain rdtsc without fences, ordering doesn't matter much at this scale and
+// fences would make the overhead far more noticeable.
+static inline uint64_t trace_timestamp()
+{
+    return __rdtsc();
+}
+
+void trace_event(const char *name, uint64_t begin, uint64_t end);
+
+struct TraceScope {
+    const char *name;
+    uint64_t begin;
+
+    explicit TraceScope(const char *name): name(name), begin(trace_timestamp()) {}
+    ~TraceScope() { trace_event(name, begin, trace_timestamp()); }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif
+
+// Writes Chrome trace-event JSON with all the recorded events. Returns false
+// if tracing is compiled out.
+bool trace_dump(const char *path);